@@ -1,11 +1,14 @@
 /*
- * SuperPi - 高精度圆周率计算工具 (Gauss-Legendre算法版本)
+ * SuperPi - 高精度圆周率与数学常数计算工具
  * 版权所有 (c) 2025 新毛宝贝 (xmb505)
  * 
- * 使用Gauss-Legendre算法计算任意精度的圆周率值
+ * 用Gauss-Legendre迭代或Chudnovsky级数计算任意精度的圆周率，
+ * 还可以计算e、sqrt2、sqrt3、phi、ln2、ln10、ζ(3)和Catalan常数
  * 结合GMP库进行高精度计算，使用FFTW3进行优化
  */
 
+#define _GNU_SOURCE     // 启用clock_gettime、pthread等POSIX/GNU扩展
+
 #include <stdio.h>      // 标准输入输出函数
 #include <stdlib.h>     // 标准库函数（内存分配、进程控制等）
 #include <string.h>     // 字符串处理函数
@@ -14,26 +17,235 @@
 #include <unistd.h>     // Unix标准函数
 #include <signal.h>     // 信号处理
 #include <math.h>       // 数学函数
+#include <pthread.h>    // POSIX线程，用于并行二分拆分
+#include <sched.h>      // sched_setaffinity，A/B对比时固定CPU
+#include <fcntl.h>      // open()
+#include <sys/mman.h>   // mmap，用于校验大结果文件
+#include <sys/stat.h>   // fstat
+#include <sys/wait.h>   // waitpid，A/B对比时运行子进程
+#include <sys/resource.h>  // getrusage，指标文件中的内存峰值
+#include <sys/syscall.h>  // SYS_gettid，看门狗报告停住的线程
+#include <dirent.h>     // 清理A/B对比的临时目录
+#include <limits.h>     // PATH_MAX
+#include <errno.h>      // 后台模式的信号处理函数要保存errno
 #include <gmp.h>        // GNU高精度数学库，用于大数计算
 #include <fftw3.h>      // FFTW库，用于优化计算
+#ifdef __SSSE3__
+#include <tmmintrin.h>  // SSSE3指令，用于十六进制展开
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>  // AVX2指令，用于快速比较结果文件
+#endif
 
 // 默认计算100万位圆周率
 #define DEFAULT_DIGITS 1000000
 // 最大支持1亿位（可根据内存扩展）
 #define MAX_DIGITS 100000000
+// --decimal-at 的最大位置：时间按位置的平方增长，10^5 位单线程约4分钟，10^6 位约6小时
+#define DECIMAL_AT_MAX 1000000ULL
+// --bench-suite 默认测到的最大位数
+#define BENCH_MAX_DIGITS 1000000
 
 // 全局变量：存储程序名称，用于错误信息输出
 char *program_name = NULL;
 // 全局变量：用于持续计算模式
 volatile sig_atomic_t keep_running = 1;
 
+// 圆周率算法选择
+#define ALGO_GAUSS_LEGENDRE 0   // Gauss-Legendre迭代（默认）
+#define ALGO_CHUDNOVSKY     1   // Chudnovsky级数 + 二分拆分
+int pi_algorithm = ALGO_GAUSS_LEGENDRE;
+// 要计算的常数（下标对应 constants[]）
+#define CONST_PI 0
+#define CONST_E  1
+#define CONST_SQRT2 2
+#define CONST_SQRT3 3
+#define CONST_PHI   4
+#define CONST_LOG2  5
+#define CONST_LOG10 6
+#define CONST_ZETA3 7
+#define CONST_CATALAN 8
+int constant_id = CONST_PI;
+// 输出进制（2到36，默认十进制）
+int output_base = 10;
+// 二分拆分时是否做质因数分解的公因子约简
+int gcd_reduction = 1;
+
+// 最多支持的工作线程数
+#define MAX_THREADS 1024
+// 工作线程数（默认等于在线CPU数）
+int num_threads = 1;
+// 二分拆分是否按预测开销选择切分点（否则取区间中点）
+int skew_split = 1;
+// 是否打印每个线程的忙碌/空闲时间
+int sched_stats = 0;
+// --diff 最多报告的不同之处
+int diff_max = 10;
+// 最近一次计算各阶段的耗时（秒）：求值和转换为数字串
+double phase_compute = 0, phase_convert = 0;
+// 最近一次计算的误差半径（log2，绝对误差）和因位数无法确认而重算的次数
+double certify_radius_log2 = 0;
+int certify_retries = 0;
+// 求值结果的误差半径（log2，绝对误差）：截断误差上界加上逐步跟踪的舍入误差，由各计算函数设置
+double radius_log2 = 0;
+// --history 判定性能回退的阈值（比滚动中位数慢的百分比）
+double regress_threshold = 10.0;
+// --ab 每个位数每个程序运行的次数
+int ab_runs = 5;
+// 安静模式：基准测试时不打印计算过程中的进度和统计
+int quiet = 0;
+// --progress-fd 指定的进度事件输出描述符（-1表示不输出）
+int progress_fd = -1;
+// --eta 在标准错误上定期打印剩余时间估计
+int show_eta = 0;
+// --tui 在压力测试和持续计算时显示终端仪表盘
+int tui_mode = 0;
+// --metrics-file 指定的Prometheus指标文件（NULL表示不写）和写入间隔（秒）
+const char *metrics_path = NULL;
+double metrics_interval = 15;
+// --watchdog 压力测试和持续计算时判定停住的最短时间（秒，0表示关闭看门狗）
+double watchdog_seconds = 60;
+// --background 计算线程用SCHED_IDLE；background_duty是CPU占用上限（百分比，100表示不限）
+int background_mode = 0;
+double background_duty = 100;
+// 后台模式按CPU压力收缩后，run_tasks最多使用的线程数（原子读写）
+int thread_limit = MAX_THREADS;
+// --placement 线程放置策略；placement_cpus是按顺序分给0号、1号……线程的CPU（个数为0表示不固定）
+#define PLACEMENT_NONE     0   // 不固定，由操作系统调度（有多个L3域时只限制在所在的域）
+#define PLACEMENT_PHYSICAL 1   // 每个物理核心一个线程
+#define PLACEMENT_LOGICAL  2   // 所有逻辑CPU，先铺满物理核心再用SMT兄弟
+#define PLACEMENT_PCORE    3   // 只用混合架构的性能核
+#define PLACEMENT_POLICIES 4
+const char *placement_names[PLACEMENT_POLICIES] = { "none", "physical", "logical", "pcore" };
+int placement_policy = PLACEMENT_NONE;
+int placement_cpus[MAX_THREADS];
+int placement_count = 0;
+// 当前线程在调度器中的编号，决定进度事件写入哪个环形缓冲区
+__thread int progress_slot = 0;
+// 进度事件的类型和计算阶段
+#define PROGRESS_START 0
+#define PROGRESS_STEP  1
+#define PROGRESS_DONE  2
+#define PHASE_NONE    0
+#define PHASE_GL      1   // Gauss-Legendre迭代
+#define PHASE_NEWTON  2   // 牛顿迭代
+#define PHASE_LEAVES  3   // 二分拆分的叶子
+#define PHASE_MERGE   4   // 二分拆分的合并层
+#define PHASE_CONVERT 5   // 转换为数字串
+#define PROGRESS_PHASES 6
+// 剩余时间模型：各步骤折合成多少次该精度上的乘法（见mul_work），按GMP实测标定
+#define ETA_GL_ITER_MULS      3.5   // 一次Gauss-Legendre迭代：一次乘法、一次平方、一次开方
+#define ETA_NEWTON_MULS       2.0   // 一步牛顿迭代，在该步的精度上
+#define ETA_MERGE_MULS        1.0   // 二分拆分合并出一个节点，在该节点的位数上
+#define ETA_FINISH_MULS       4.0   // 求值末尾的除法、开方等
+#define ETA_CONVERT_LOG_MULS  0.3   // 转换为十进制等：约 0.3*log2(位数) 次乘法
+#define ETA_CONVERT_POW2_MULS 0.5   // 2的幂进制直接展开尾数，接近线性
+// 心跳状态，看门狗只检查RUN的线程
+#define HEARTBEAT_IDLE 0   // 不在计算（轮与轮之间，或调度器里没有任务的线程）
+#define HEARTBEAT_RUN  1   // 正在计算，应当定期有心跳
+#define HEARTBEAT_WAIT 2   // 调用者线程在等其他线程完成任务
+#define EXIT_STALLED 3     // 看门狗发现计算停住时的退出码
+// 误差半径与位数验证
+#define GUARD_INT_BITS 2           // 所有常数都小于4，整数部分最多占2位
+#define CERTIFY_TAIL_DIGITS 32     // 在要求的位数之后多转换的位数，用来判断末位是否可信
+#define CERTIFY_RETRIES 4          // 位数无法确认时最多重算几次
+#define CERTIFY_RETRY_DIGITS 16    // 第i次重算多算 16*2^i 位
+
 // 函数声明（提前声明，让编译器知道这些函数的存在）
 void print_usage(void);           // 打印使用帮助
 void print_version(void);         // 打印版本信息
 void signal_handler(int sig);     // 信号处理函数
-uint64_t calculate_pi_digits(uint64_t digits, char **result);  // 计算圆周率
-void save_pi_to_file(const char *pi_str, uint64_t digits);     // 保存结果到文件
+uint64_t calculate_constant_digits(uint64_t digits, char **result);  // 计算所选常数
+uint64_t evaluate_constant(uint64_t digits, uint64_t work, char **result);  // 按work位精度求值并验证前digits位
+void save_result_to_file(const char *digits_str, uint64_t digits);  // 保存结果到文件
 void print_progress_time(uint64_t current_digits, double elapsed_time);  // 显示进度时间
+int parse_algorithm(const char *name);                         // 解析算法名称
+int parse_constant(const char *name);                          // 解析常数名称
+const char *algorithm_name(void);                              // 当前算法名称
+void compute_pi(mpf_t pi, uint64_t digits);                    // 按所选算法计算π
+void compute_pi_gauss_legendre(mpf_t pi, uint64_t digits);     // Gauss-Legendre迭代
+void compute_pi_chudnovsky(mpf_t pi, uint64_t digits);         // Chudnovsky二分拆分
+void compute_e(mpf_t e, uint64_t digits);                      // e的二分拆分
+void compute_sqrt2(mpf_t x, uint64_t digits);                  // 牛顿迭代求sqrt(2)
+void compute_sqrt3(mpf_t x, uint64_t digits);                  // 牛顿迭代求sqrt(3)
+void compute_phi(mpf_t x, uint64_t digits);                    // 黄金分割比 (1+sqrt(5))/2
+void compute_log2(mpf_t x, uint64_t digits);                   // 类Machin公式求ln(2)
+void compute_log10(mpf_t x, uint64_t digits);                  // 类Machin公式求ln(10)
+void compute_zeta3(mpf_t x, uint64_t digits);                  // Amdeberhan-Zeilberger级数求ζ(3)
+void compute_catalan(mpf_t x, uint64_t digits);                // Guillera级数求Catalan常数
+mp_bitcnt_t digits_to_bits(uint64_t digits);                   // 十进制位数对应的二进制位数
+mp_bitcnt_t base_digits_to_bits(uint64_t digits, int base);    // 任意进制位数对应的二进制位数
+mp_bitcnt_t guard_bits(uint64_t digits);                       // 按当前算法的舍入误差估计保护位数
+double rounding_log2(uint64_t digits);                         // 当前算法舍入误差的放大系数（log2）
+double log2_sum(double a, double b);                           // log2(2^a + 2^b)
+double ball_mag(mpf_t x);                                      // log2|x| 的上界
+double ball_low(mpf_t x);                                      // log2|x| 的下界
+double ball_round(double r, mpf_t x);                          // 半径加上x截断到其精度的误差
+double ball_mul(mpf_t a, double ra, mpf_t b, double rb);       // a*b 的传递误差
+double ball_div(mpf_t a, double ra, mpf_t b, double rb);       // a/b 的传递误差
+double ball_sqrt(mpf_t a, double ra);                          // sqrt(a) 的传递误差
+double mpf_set_ratio(mpf_t x, mpz_t t, mpz_t q);               // x = t/q，返回误差半径
+uint64_t certify_prefix(const char *s, uint64_t digits, uint64_t known, int base);  // 误差半径确认的位数
+int mpf_to_fraction_digits(mpf_t x, uint64_t digits, char **result);  // 转换为小数部分字符串
+int mpf_to_pow2_digits(mpf_t x, uint64_t digits, int bits_per_digit, char **result);  // 2的幂进制
+int mpf_to_base_digits(mpf_t x, uint64_t digits, int base, char **result);  // 十进制及其他进制
+double wall_time(void);                                        // 单调墙钟时间（秒）
+int stream_pi_digits(uint64_t digits);                         // 用spigot算法边算边输出π
+void pi_digits_at(uint64_t pos, char out[10]);                 // 不计算前面的位，直接求第pos位起的9位
+int verify_result_file(const char *path);                      // 校验已有的π结果文件
+int diff_result_files(const char *path_a, const char *path_b);  // 比较两个结果文件
+void history_append(uint64_t digits, const char *result, double seconds);  // 追加一条运行记录
+int show_history(void);                                        // 显示历史趋势并检查性能回退
+int ab_compare(const char *other, char **args, int nargs, uint64_t digits);  // 与另一个版本做A/B对比
+int bench_suite(uint64_t max_digits);                          // 位数×线程数的基准测试套件
+int run_selftest(void);                                        // 与内置参考值对比的正确性测试
+void progress_start(void);                                     // 启动进度事件的汇报线程
+void progress_stop(void);                                      // 输出剩余事件并停止汇报线程
+void progress_post(int event, int phase, uint64_t step, uint64_t steps, uint64_t digits,
+                   double work, double total);                 // 发布进度事件
+void progress_begin_run(void);                                 // 开始新的一轮步骤，步号从头计
+double mul_work(double bits);                                  // 一次bits位乘法的预测开销
+void heartbeat_beat(int phase, uint64_t step, uint64_t steps);  // 本线程完成一步，记录心跳
+int heartbeat_state(int state);                                // 设置本线程的心跳状态，返回原状态
+void heartbeat_task(void);                                     // 调度器的任务边界心跳
+void throttle_begin(void);                                     // 后台模式：本线程按占用上限限速
+void throttle_end(void);                                       // 取消本线程的限速
+void background_enter(void);                                   // 切换到后台模式（在创建线程之前）
+void background_summary(void);                                 // 报告后台模式的吞吐量
+int placement_setup(int policy, int set_threads);              // 按策略确定各线程的CPU并固定主线程
+void placement_attr(pthread_attr_t *attr, int id, int domain); // 把id号线程固定到对应的CPU或L3域
+int placement_benchmark(uint64_t digits);                      // 各放置策略的性能对比
+void llc_init(void);                                           // 从sysfs读出各CPU所在的L3域
+void llc_build_order(void);                                    // 按各CPU的L3域排出不固定线程的分域顺序
+int llc_worker_domain(int id);                                 // id号线程所在的L3域
+int read_long_file(const char *path, long *value);             // 读出文件中的一个整数
+int stress_run(uint64_t digits, double seconds);               // 每个CPU一个进程的压力测试
+void run_stats_start(int watchdog);                            // 启动仪表盘、指标文件和看门狗线程
+void run_stats_round(uint64_t digits, int finished, uint64_t bad, int checked, double seconds);  // 更新计数器
+void run_stats_stop(void);                                     // 停止线程并写最后一次指标
+uint64_t golden_mismatch(const char *got, const char *expect, uint64_t n);  // 第一个不同的位置
+uint64_t gl_correct_digits(unsigned long n, uint64_t digits);  // Gauss-Legendre迭代n次后的正确位数
+
+/* 可计算的常数 */
+typedef struct {
+    const char *option;       // --constant= 的取值
+    const char *name;         // 显示名称，也是结果文件名前缀
+    const char *int_part;     // 整数部分，写在结果文件开头
+    const char *algorithm;    // 写入结果文件的算法说明（NULL表示按 --algo）
+    void (*compute)(mpf_t x, uint64_t digits);  // 计算函数，x已按默认精度初始化
+} constant_t;
+
+const constant_t constants[] = {
+    { "pi", "圆周率", "3", NULL,              compute_pi },
+    { "e",  "e",      "2", "二分拆分 Σ1/k!", compute_e  },
+    { "sqrt2", "根号2", "1", "牛顿迭代 1/sqrt(x)", compute_sqrt2 },
+    { "sqrt3", "根号3", "1", "牛顿迭代 1/sqrt(x)", compute_sqrt3 },
+    { "phi", "黄金分割比", "1", "牛顿迭代 1/sqrt(x)", compute_phi },
+    { "log2", "ln2", "0", "类Machin公式 arccoth二分拆分", compute_log2 },
+    { "log10", "ln10", "2", "类Machin公式 arccoth二分拆分", compute_log10 },
+    { "zeta3", "zeta3", "1", "Amdeberhan-Zeilberger级数二分拆分", compute_zeta3 },
+    { "catalan", "卡塔兰常数", "0", "Guillera级数二分拆分", compute_catalan },
+};
 
 // 信号处理函数，用于处理Ctrl+C
 void signal_handler(int sig) {
@@ -46,56 +258,309 @@ void signal_handler(int sig) {
 int main(int argc, char *argv[]) {
     uint64_t digits = DEFAULT_DIGITS;  // 默认计算位数
     int keep_mode = 0;  // 持续计算模式标志
+    int stream_mode = 0;  // 流式输出模式标志
+    uint64_t decimal_at = 0;  // --decimal-at 指定的位置（0表示不用）
+    const char *verify_path = NULL;  // --verify-file 指定的文件
+    const char *diff_a = NULL, *diff_b = NULL;  // --diff 比较的两个文件
+    int history_mode = 0;  // --history 显示历史记录
+    const char *ab_other = NULL;  // --ab 对比的另一个程序
+    int bench_mode = 0;  // --bench-suite 基准测试套件
+    int selftest_mode = 0;  // --selftest 正确性测试
+    int stress_mode = 0;  // --stress 压力测试
+    double stress_seconds = 0;  // 压力测试的时长（0表示直到Ctrl+C）
+    int threads_given = 0;  // 是否用--threads指定了线程数
+    int placement_bench = 0;  // --placement-bench 各放置策略的性能对比
     
     program_name = argv[0];  // 保存程序名称，用于错误提示
     
+    /* 默认每个在线CPU一个工作线程 */
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = cpus < 1 ? 1 : (cpus > MAX_THREADS ? MAX_THREADS : (int)cpus);
+    
     /* 注册信号处理函数 */
     signal(SIGINT, signal_handler);
     
     /* 解析命令行参数 */
-    if (argc > 2) {  // 参数太多，显示用法
-        fprintf(stderr, "用法: %s [选项] [位数]\n", program_name);
-        return 1;  // 返回错误码1
-    }
-    
-    if (argc == 1) {  // 无参数，进入交互模式
-        printf("SuperPi - 高精度圆周率计算工具\n");
-        printf("使用Gauss-Legendre算法计算π值\n");
-        printf("支持无限精度计算\n\n");
-        printf("请输入要计算的圆周率位数: ");
-        
-        if (scanf("%lu", &digits) != 1) {
-            fprintf(stderr, "错误: 请输入一个有效的数字\n");
-            return 1;
-        }
-        
-        if (digits <= 0 || digits > MAX_DIGITS) {
-            fprintf(stderr, "错误: 位数必须在1到%llu之间\n", (unsigned long long)MAX_DIGITS);
-            return 1;
-        }
-    } else if (argc == 2) {  // 用户提供了一个参数
+    int have_digits = 0;  // 是否在命令行给出了位数
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
         // 检查是否是帮助选项
-        if (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0) {
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
             print_usage();  // 显示帮助信息
             return 0;  // 正常退出
         }
         // 检查是否是版本选项
-        if (strcmp(argv[1], "--version") == 0 || strcmp(argv[1], "-v") == 0) {
+        if (strcmp(arg, "--version") == 0 || strcmp(arg, "-v") == 0) {
             print_version();  // 显示版本信息
             return 0;  // 正常退出
         }
-        // 检查是否是持续计算选项
-        if (strcmp(argv[1], "--keep") == 0 || strcmp(argv[1], "-k") == 0) {
+        if (strcmp(arg, "--keep") == 0 || strcmp(arg, "-k") == 0) {
+            // 持续计算选项
             keep_mode = 1;
             digits = 1000;  // 初始位数
+        } else if (strcmp(arg, "--stream") == 0) {
+            // 边算边把数字输出到标准输出
+            stream_mode = 1;
+        } else if (strcmp(arg, "--decimal-at") == 0 || strncmp(arg, "--decimal-at=", 13) == 0) {
+            // 直接提取π小数点后指定位置的数字
+            const char *value = arg[12] == '=' ? arg + 13 : (i + 1 < argc ? argv[++i] : "");
+            char *endptr;
+            decimal_at = strtoull(value, &endptr, 10);
+            if (*value == '\0' || *endptr != '\0' || decimal_at == 0 || decimal_at > DECIMAL_AT_MAX) {
+                fprintf(stderr, "错误: --decimal-at 的位置必须在1到%llu之间\n",
+                        (unsigned long long)DECIMAL_AT_MAX);
+                return 1;
+            }
+        } else if (strcmp(arg, "--verify-file") == 0 || strncmp(arg, "--verify-file=", 14) == 0) {
+            // 校验已有的结果文件
+            verify_path = arg[13] == '=' ? arg + 14 : (i + 1 < argc ? argv[++i] : "");
+            if (*verify_path == '\0') {
+                fprintf(stderr, "错误: --verify-file 需要文件名\n");
+                return 1;
+            }
+        } else if (strcmp(arg, "--diff") == 0) {
+            // 比较两个结果文件
+            if (i + 2 >= argc) {
+                fprintf(stderr, "错误: --diff 需要两个文件名\n");
+                return 1;
+            }
+            diff_a = argv[++i];
+            diff_b = argv[++i];
+        } else if (strncmp(arg, "--diff-max=", 11) == 0) {
+            // --diff 最多报告的不同之处
+            diff_max = atoi(arg + 11);
+            if (diff_max < 1) {
+                fprintf(stderr, "错误: --diff-max 必须大于0\n");
+                return 1;
+            }
+        } else if (strcmp(arg, "--history") == 0) {
+            // 显示历史趋势和性能回退
+            history_mode = 1;
+        } else if (strncmp(arg, "--regress-threshold=", 20) == 0) {
+            // 判定性能回退的阈值（百分比）
+            regress_threshold = atof(arg + 20);
+            if (regress_threshold <= 0) {
+                fprintf(stderr, "错误: --regress-threshold 必须大于0\n");
+                return 1;
+            }
+        } else if (strcmp(arg, "--ab") == 0 || strncmp(arg, "--ab=", 5) == 0) {
+            // 与另一个版本的程序做A/B性能对比
+            ab_other = arg[4] == '=' ? arg + 5 : (i + 1 < argc ? argv[++i] : "");
+            if (*ab_other == '\0') {
+                fprintf(stderr, "错误: --ab 需要另一个程序的路径\n");
+                return 1;
+            }
+        } else if (strncmp(arg, "--ab-runs=", 10) == 0) {
+            // A/B对比时每个程序的运行次数
+            ab_runs = atoi(arg + 10);
+            if (ab_runs < 2) {
+                fprintf(stderr, "错误: --ab-runs 至少为2\n");
+                return 1;
+            }
+        } else if (strcmp(arg, "--bench-suite") == 0) {
+            // 位数×线程数的基准测试套件
+            bench_mode = 1;
+        } else if (strcmp(arg, "--selftest") == 0) {
+            // 与内置参考值对比的正确性测试
+            selftest_mode = 1;
+        } else if (strncmp(arg, "--progress-fd=", 14) == 0) {
+            // 把JSON格式的进度事件写到指定的文件描述符
+            char *endptr;
+            long fd = strtol(arg + 14, &endptr, 10);
+            if (*endptr != '\0' || fd < 0 || fd > INT32_MAX || fcntl((int)fd, F_GETFD) == -1) {
+                fprintf(stderr, "错误: --progress-fd 不是有效的文件描述符\n");
+                return 1;
+            }
+            progress_fd = (int)fd;
+        } else if (strcmp(arg, "--stress") == 0 || strncmp(arg, "--stress=", 9) == 0) {
+            // 每个CPU一个进程反复计算并与参考结果对比
+            stress_mode = 1;
+            if (arg[8] == '=') {
+                char *endptr;
+                stress_seconds = strtod(arg + 9, &endptr);
+                if (*endptr != '\0' || stress_seconds <= 0) {
+                    fprintf(stderr, "错误: --stress 的时长必须是正的秒数\n");
+                    return 1;
+                }
+            }
+        } else if (strncmp(arg, "--metrics-file=", 15) == 0) {
+            // 定期写Prometheus文本格式的指标文件
+            metrics_path = arg + 15;
+            if (*metrics_path == '\0') {
+                fprintf(stderr, "错误: --metrics-file 需要文件名\n");
+                return 1;
+            }
+        } else if (strncmp(arg, "--metrics-interval=", 19) == 0) {
+            // 指标文件的写入间隔（秒）
+            metrics_interval = atof(arg + 19);
+            if (metrics_interval <= 0) {
+                fprintf(stderr, "错误: --metrics-interval 必须大于0\n");
+                return 1;
+            }
+        } else if (strncmp(arg, "--watchdog=", 11) == 0) {
+            // 判定计算停住的最短时间（秒），0表示关闭看门狗
+            char *endptr;
+            watchdog_seconds = strtod(arg + 11, &endptr);
+            if (*endptr != '\0' || arg[11] == '\0' || watchdog_seconds < 0) {
+                fprintf(stderr, "错误: --watchdog 必须是不小于0的秒数\n");
+                return 1;
+            }
+        } else if (strcmp(arg, "--background") == 0 || strncmp(arg, "--background=", 13) == 0) {
+            // 低优先级后台运行，可选每个线程的CPU占用上限（百分比）
+            background_mode = 1;
+            if (arg[12] == '=') {
+                char *endptr;
+                background_duty = strtod(arg + 13, &endptr);
+                if (*endptr != '\0' || background_duty <= 0 || background_duty > 100) {
+                    fprintf(stderr, "错误: --background 的占用上限必须在0到100之间\n");
+                    return 1;
+                }
+            }
+        } else if (strcmp(arg, "--tui") == 0) {
+            // 终端仪表盘
+            tui_mode = 1;
+        } else if (strcmp(arg, "--eta") == 0) {
+            // 定期打印剩余时间估计
+            show_eta = 1;
+        } else if (strncmp(arg, "--algo=", 7) == 0) {
+            // 选择计算圆周率的算法
+            if (parse_algorithm(arg + 7) != 0) {
+                fprintf(stderr, "错误: 未知算法 %s（可选 gl、chudnovsky）\n", arg + 7);
+                return 1;
+            }
+        } else if (strncmp(arg, "--constant=", 11) == 0) {
+            // 选择要计算的常数
+            if (parse_constant(arg + 11) != 0) {
+                fprintf(stderr, "错误: 未知常数 %s（可选 pi、e、sqrt2、sqrt3、phi、log2、log10、zeta3、catalan）\n", arg + 11);
+                return 1;
+            }
+        } else if (strncmp(arg, "--base=", 7) == 0) {
+            // 输出进制
+            output_base = atoi(arg + 7);
+            if (output_base < 2 || output_base > 36) {
+                fprintf(stderr, "错误: 进制必须在2到36之间\n");
+                return 1;
+            }
+        } else if (strcmp(arg, "--no-gcd") == 0) {
+            // 关闭二分拆分的公因子约简（用于对比）
+            gcd_reduction = 0;
+        } else if (strncmp(arg, "--threads=", 10) == 0) {
+            // 工作线程数
+            num_threads = atoi(arg + 10);
+            if (num_threads < 1 || num_threads > MAX_THREADS) {
+                fprintf(stderr, "错误: 线程数必须在1到%d之间\n", MAX_THREADS);
+                return 1;
+            }
+            threads_given = 1;
+        } else if (strncmp(arg, "--placement=", 12) == 0) {
+            // 线程放置策略
+            placement_policy = -1;
+            for (int p = 0; p < PLACEMENT_POLICIES; p++) {
+                if (strcmp(arg + 12, placement_names[p]) == 0) placement_policy = p;
+            }
+            if (placement_policy < 0) {
+                fprintf(stderr, "错误: 未知放置策略 %s（可选 none、physical、logical、pcore）\n", arg + 12);
+                return 1;
+            }
+        } else if (strcmp(arg, "--placement-bench") == 0) {
+            // 比较各放置策略的速度
+            placement_bench = 1;
+        } else if (strncmp(arg, "--split=", 8) == 0) {
+            // 二分拆分的切分方式
+            if (strcmp(arg + 8, "skew") == 0) {
+                skew_split = 1;
+            } else if (strcmp(arg + 8, "balanced") == 0) {
+                skew_split = 0;
+            } else {
+                fprintf(stderr, "错误: 未知切分方式 %s（可选 skew、balanced）\n", arg + 8);
+                return 1;
+            }
+        } else if (strcmp(arg, "--sched-stats") == 0) {
+            // 打印每个线程的忙碌/空闲时间
+            sched_stats = 1;
+        } else if (arg[0] == '-') {
+            fprintf(stderr, "错误: 未知选项 %s\n", arg);
+            fprintf(stderr, "用法: %s [选项] [位数]\n", program_name);
+            return 1;
         } else {
+            if (have_digits) {  // 位数只能给一次
+                fprintf(stderr, "用法: %s [选项] [位数]\n", program_name);
+                return 1;  // 返回错误码1
+            }
             /* 解析用户输入的位数 */
             char *endptr;  // 用于检测转换是否成功
-            digits = strtoull(argv[1], &endptr, 10);  // 将字符串转换为无符号长整数
+            digits = strtoull(arg, &endptr, 10);  // 将字符串转换为无符号长整数
             if (*endptr != '\0' || digits == 0) {  // 转换失败或输入为0
                 fprintf(stderr, "错误: 无效的位数输入。\n");
                 return 1;  // 返回错误码1
             }
+            have_digits = 1;
+        }
+    }
+    
+    /* 线程放置：没有用--threads指定时，线程数取策略选出的CPU数 */
+    if (placement_bench) {
+        return placement_benchmark(have_digits ? digits : BENCH_MAX_DIGITS);
+    }
+    if (placement_policy != PLACEMENT_NONE && placement_setup(placement_policy, !threads_given) != 0) {
+        return 1;
+    }
+    
+    /* 校验文件和数字提取不需要位数，直接输出后退出 */
+    if (verify_path) {
+        return verify_result_file(verify_path);
+    }
+    if (diff_a) {
+        return diff_result_files(diff_a, diff_b);
+    }
+    if (history_mode) {
+        return show_history();
+    }
+    if (selftest_mode) {
+        return run_selftest();
+    }
+    if (bench_mode) {
+        return bench_suite(have_digits ? digits : BENCH_MAX_DIGITS);
+    }
+    if (ab_other) {
+        /* 除了A/B对比本身的选项和位数，其余选项原样传给两边的子进程 */
+        char **args = malloc((size_t)argc * sizeof(char *));
+        int nargs = 0;
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "--ab") == 0) {
+                i++;
+            } else if (strncmp(argv[i], "--ab=", 5) != 0 && strncmp(argv[i], "--ab-runs=", 10) != 0 &&
+                       argv[i][0] == '-') {
+                args[nargs++] = argv[i];
+            }
+        }
+        int ret = ab_compare(ab_other, args, nargs, have_digits ? digits : 0);
+        free(args);
+        return ret;
+    }
+    if (decimal_at > 0) {
+        char out[10];
+        double start = wall_time();
+        pi_digits_at(decimal_at, out);
+        printf("π小数点后第 %llu 位起的9位数字: %s\n", (unsigned long long)decimal_at, out);
+        printf("耗时 %.2f 秒（%d线程）\n", wall_time() - start, num_threads);
+        return 0;
+    }
+    
+    if (!have_digits && !keep_mode) {  // 没有给出位数，进入交互模式
+        printf("SuperPi - 高精度圆周率计算工具\n");
+        printf("使用%s算法计算%s\n", algorithm_name(), constants[constant_id].name);
+        printf("支持无限精度计算\n\n");
+        printf("请输入要计算的%s位数: ", constants[constant_id].name);
+        
+        if (scanf("%lu", &digits) != 1) {
+            fprintf(stderr, "错误: 请输入一个有效的数字\n");
+            return 1;
+        }
+        
+        if (digits <= 0 || digits > MAX_DIGITS) {
+            fprintf(stderr, "错误: 位数必须在1到%llu之间\n", (unsigned long long)MAX_DIGITS);
+            return 1;
         }
     }
     
@@ -105,38 +570,86 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    /* 流式输出只支持十进制的π */
+    if (stream_mode) {
+        if (keep_mode || constant_id != CONST_PI || output_base != 10) {
+            fprintf(stderr, "错误: --stream 只支持十进制π，且不能与 --keep 同用\n");
+            return 1;
+        }
+        return stream_pi_digits(digits) ? 0 : 1;
+    }
+    
+    /* 仪表盘只用于压力测试和持续计算，而且要输出到终端 */
+    if (tui_mode && !stress_mode && !keep_mode) {
+        fprintf(stderr, "错误: --tui 只能与 --stress 或 --keep 同用\n");
+        return 1;
+    }
+    if (tui_mode && !isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "警告: 标准输出不是终端，不显示仪表盘\n");
+        tui_mode = 0;
+    }
+    if (background_mode) background_enter();  // 要在创建任何线程之前
+    if (stress_mode) {
+        if (keep_mode) {
+            fprintf(stderr, "错误: --stress 不能与 --keep 同用\n");
+            return 1;
+        }
+        return stress_run(digits, stress_seconds);
+    }
+    
     /* 开始计算 */
+    progress_start();
     if (keep_mode) {
-        printf("SuperPi - 持续计算圆周率模式\n");
+        printf("SuperPi - 持续计算%s模式\n", constants[constant_id].name);
         printf("按Ctrl+C停止计算\n\n");
+        run_stats_start(1);
         
         uint64_t current_digits = 1000;
+        char *prev_str = NULL;  // 上一轮的结果，与本轮的公共前缀应当相同
+        uint64_t prev_digits = 0;
         while (keep_running) {
-            printf("SuperPi - 正在计算圆周率到 %llu 位...\n", (unsigned long long)current_digits);
-            printf("开始时间: %s\n", __TIME__);
+            if (!tui_mode) {
+                printf("SuperPi - 正在计算%s到 %llu 位...\n", constants[constant_id].name,
+                       (unsigned long long)current_digits);
+                printf("开始时间: %s\n", __TIME__);
+            }
+            run_stats_round(current_digits, 0, 0, 0, 0);
             
-            clock_t start = clock();  // 记录开始时间
+            double start = wall_time();  // 记录开始时间
             
             /* 调用核心计算函数 */
-            char *pi_result = NULL;  // 用于存储计算结果
-            uint64_t calculated = calculate_pi_digits(current_digits, &pi_result);  // 实际计算
+            char *result_str = NULL;  // 用于存储计算结果
+            uint64_t calculated = calculate_constant_digits(current_digits, &result_str);  // 实际计算
             
-            clock_t end = clock();  // 记录结束时间
-            double elapsed = ((double)(end - start)) / CLOCKS_PER_SEC;  // 计算耗时（秒）
+            double elapsed = wall_time() - start;  // 计算耗时（秒）
             
             /* 处理计算结果 */
-            if (calculated > 0 && pi_result && keep_running) {  // 计算成功且未被中断
-                printf("圆周率计算完成，耗时 %.2f 秒\n", elapsed);
-                printf("平均性能: %.2f 位/秒\n", (double)calculated / elapsed);
-                save_pi_to_file(pi_result, calculated);  // 保存结果到文件
-                free(pi_result);  // 释放内存，防止内存泄漏
+            if (calculated > 0 && result_str && keep_running) {  // 计算成功且未被中断
+                uint64_t common = prev_digits < calculated ? prev_digits : calculated;
+                uint64_t bad = prev_str ? golden_mismatch(result_str, prev_str, common) : 0;
+                run_stats_round(calculated, 1, bad, prev_str != NULL, elapsed);  // 第一轮没有可对比的
+                if (!tui_mode) {
+                    printf("%s计算完成，耗时 %.2f 秒\n", constants[constant_id].name, elapsed);
+                    printf("平均性能: %.2f 位/秒\n", (double)calculated / elapsed);
+                    printf("阶段耗时: 计算 %.4f 秒，转换 %.4f 秒\n", phase_compute, phase_convert);
+                    printf("已验证位数: %llu（误差半径 < 2^%.0f，提高精度重算 %d 次）\n",
+                           (unsigned long long)calculated, ceil(certify_radius_log2), certify_retries);
+                    if (bad) {
+                        printf("错误: 第 %llu 位与上一轮的结果不符\n", (unsigned long long)bad);
+                    }
+                }
+                save_result_to_file(result_str, calculated);  // 保存结果到文件
+                history_append(calculated, result_str, elapsed);  // 记录到历史
+                free(prev_str);  // 只保留最近一轮，下一轮用来对比
+                prev_str = result_str;
+                prev_digits = calculated;
             } else if (!keep_running) {  // 被用户中断
                 printf("计算已被用户中断\n");
-                if (pi_result) free(pi_result);
+                if (result_str) free(result_str);
                 break;
             } else {  // 计算失败
-                fprintf(stderr, "错误: 圆周率计算失败\n");
-                if (pi_result) free(pi_result);
+                fprintf(stderr, "错误: %s计算失败\n", constants[constant_id].name);
+                if (result_str) free(result_str);
                 break;
             }
             
@@ -149,32 +662,46 @@ int main(int argc, char *argv[]) {
             // 短暂休眠避免CPU占用过高
             sleep(1);
         }
+        free(prev_str);
+        run_stats_stop();
+        if (background_mode) background_summary();
     } else {
-        printf("SuperPi - 正在计算圆周率到 %llu 位...\n", (unsigned long long)digits);
+        printf("SuperPi - 正在计算%s到 %llu 位...\n", constants[constant_id].name,
+               (unsigned long long)digits);
         printf("开始时间: %s\n", __TIME__);
         
-        clock_t start = clock();  // 记录开始时间
+        double start = wall_time();  // 记录开始时间
+        run_stats_start(0);
+        run_stats_round(digits, 0, 0, 0, 0);
         
         /* 调用核心计算函数 */
-        char *pi_result = NULL;  // 用于存储计算结果
-        uint64_t calculated = calculate_pi_digits(digits, &pi_result);  // 实际计算
+        char *result_str = NULL;  // 用于存储计算结果
+        uint64_t calculated = calculate_constant_digits(digits, &result_str);  // 实际计算
         
-        clock_t end = clock();  // 记录结束时间
-        double elapsed = ((double)(end - start)) / CLOCKS_PER_SEC;  // 计算耗时（秒）
+        double elapsed = wall_time() - start;  // 计算耗时（秒）
+        run_stats_round(digits, 1, calculated == 0, 0, elapsed);  // 单次计算没有参考值可对比
+        run_stats_stop();
         
         /* 处理计算结果 */
-        if (calculated > 0 && pi_result) {  // 计算成功
-            printf("圆周率计算完成，耗时 %.2f 秒\n", elapsed);
+        if (calculated > 0 && result_str) {  // 计算成功
+            printf("%s计算完成，耗时 %.2f 秒\n", constants[constant_id].name, elapsed);
             printf("平均性能: %.2f 位/秒\n", (double)calculated / elapsed);
-            save_pi_to_file(pi_result, calculated);  // 保存结果到文件
-            free(pi_result);  // 释放内存，防止内存泄漏
+            printf("阶段耗时: 计算 %.4f 秒，转换 %.4f 秒\n", phase_compute, phase_convert);
+            printf("已验证位数: %llu（误差半径 < 2^%.0f，提高精度重算 %d 次）\n",
+                   (unsigned long long)calculated, ceil(certify_radius_log2), certify_retries);
+            save_result_to_file(result_str, calculated);  // 保存结果到文件
+            history_append(calculated, result_str, elapsed);  // 记录到历史
+            free(result_str);  // 释放内存，防止内存泄漏
+            if (background_mode) background_summary();
         } else {  // 计算失败
-            fprintf(stderr, "错误: 圆周率计算失败\n");
-            if (pi_result) free(pi_result);
+            fprintf(stderr, "错误: %s计算失败\n", constants[constant_id].name);
+            if (result_str) free(result_str);
+            progress_stop();
             return 1;
         }
     }
     
+    progress_stop();
     return 0;  // 程序正常结束
 }
 
@@ -187,8 +714,38 @@ void print_usage(void) {
     printf("  -h, --help     显示此帮助信息\n");
     printf("  -v, --version  显示版本信息\n");
     printf("  -k, --keep     持续计算圆周率并保存到文件\n");
+    printf("  --constant=C   要计算的常数: pi（默认）、e、sqrt2、sqrt3、phi、log2、log10、\n");
+    printf("                 zeta3、catalan\n");
+    printf("  --base=B       输出进制（2到36，默认10）；2、4、8、16、32直接由二进制尾数展开\n");
+    printf("  --stream       用spigot算法边算边把π输出到标准输出（适合中小位数）\n");
+    printf("  --decimal-at N 不计算前面的位，直接求π小数点后第N位起的9位数字\n");
+    printf("  --verify-file F 校验已有的十进制π结果文件，报告第一个错误位置\n");
+    printf("  --diff A B     比较两个结果文件，报告前几处不同（--diff-max=N，默认10）\n");
+    printf("  --history      显示本机历史运行趋势，标出性能回退（--regress-threshold=P，默认10%%）\n");
+    printf("  --ab PROG      与另一个SuperPi程序交替运行做性能对比（--ab-runs=N，默认5次）\n");
+    printf("  --bench-suite  基准测试套件：各数量级位数×2的幂线程数，输出扩展性和复杂度拟合\n");
+    printf("  --selftest     正确性测试：各算法、常数、进制和线程数在边界位数下与内置参考值对比\n");
+    printf("  --progress-fd=N 把每行一个JSON的进度事件写到文件描述符N\n");
+    printf("  --eta          每秒在标准错误上打印一次剩余时间估计和置信区间\n");
+    printf("  --stress[=S]   压力测试：每个CPU一个进程反复计算并与参考结果对比，运行S秒或到Ctrl+C\n");
+    printf("  --tui          压力测试和持续计算时显示终端仪表盘（各CPU状态、频率、温度）\n");
+    printf("  --metrics-file=F 每隔--metrics-interval=N秒（默认15）把计数器写成Prometheus文本格式\n");
+    printf("  --background[=P] 低优先级后台运行：SCHED_IDLE，每线程CPU占用不超过P%%，\n");
+    printf("                 CPU压力大时自动减少线程，结束时报告吞吐量\n");
+    printf("  --watchdog=S   压力测试和持续计算时，计算线程超过S秒（默认60，0关闭）且远超平时没有进展\n");
+    printf("                 就报告停住的CPU和阶段并以退出码3结束\n");
+    printf("  --algo=NAME    选择算法: gl（Gauss-Legendre，默认）或 chudnovsky\n");
+    printf("  --no-gcd       Chudnovsky二分拆分时不做公因子约简\n");
+    printf("  --threads=N    工作线程数（默认等于CPU数）\n");
+    printf("  --split=MODE   二分拆分切分方式: skew（按预测开销，默认）或 balanced（取中点）\n");
+    printf("  --sched-stats  打印每个线程的忙碌与空闲时间\n");
+    printf("  --placement=P  线程放置并固定CPU: none（默认）、physical（每物理核心一个）、\n");
+    printf("                 logical（所有逻辑CPU）、pcore（只用性能核）；未给--threads时线程数取CPU数\n");
+    printf("  --placement-bench 按拓扑比较各放置策略的速度，报告最快的一种\n");
     printf("\n示例:\n");
     printf("  %s 1000        计算1000位\n", program_name);
+    printf("  %s --algo=chudnovsky 1000000  用Chudnovsky算法计算100万位\n", program_name);
+    printf("  %s --constant=e 1000000       计算e的100万位\n", program_name);
     printf("  %s --keep      持续计算圆周率\n", program_name);
     printf("  %s --version   显示版本信息\n", program_name);
     printf("\n系统要求:\n");
@@ -199,7 +756,8 @@ void print_usage(void) {
 void print_version(void) {
     printf("SuperPi 5.0.0\n");
     printf("版权所有 (c) 2025 新毛宝贝 (xmb505)\n");
-    printf("使用Gauss-Legendre算法计算圆周率，支持无限精度\n");
+    printf("用Gauss-Legendre或Chudnovsky算法计算圆周率，支持任意精度\n");
+    printf("另可计算 e、sqrt2、sqrt3、phi、ln2、ln10、ζ(3)、Catalan常数\n");
     printf("针对64位系统优化\n");
     printf("博客: blog.xmb505.top\n");
     
@@ -227,30 +785,148 @@ void print_progress_time(uint64_t current_digits, double elapsed_time) {
 }
 
 /*
- * 计算圆周率的核心函数
- * 使用Gauss-Legendre算法结合GMP高精度库进行计算
+ * 计算常数的核心函数
+ * 按 --constant 选择的常数（默认π）结合GMP高精度库进行计算，
+ * 只输出误差半径能确认的位数。各计算函数逐步跟踪实际的误差半径，半径不够小
+ * （保护位估计不足），或末位附近出现一串0或最大数字（如 ...999|9）、
+ * 分不清真值在进位的哪一侧时，多算一些位重新求值
  * 
  * 参数说明：
  *   digits - 要计算的小数位数
  *   result - 用于存储结果的字符串指针（通过参数返回）
- * 返回值：实际计算的位数，失败返回0
+ * 返回值：实际计算并验证通过的位数，失败返回0
  */
-uint64_t calculate_pi_digits(uint64_t digits, char **result) {
+uint64_t calculate_constant_digits(uint64_t digits, char **result) {
     /* 参数检查 */
     if (!result || digits <= 0 || digits > MAX_DIGITS) return 0;
     
+    uint64_t certified = 0;
+    certify_retries = 0;
+    for (int attempt = 0; attempt <= CERTIFY_RETRIES; attempt++) {
+        uint64_t extra = attempt ? (uint64_t)CERTIFY_RETRY_DIGITS << attempt : 0;
+        certified = evaluate_constant(digits, digits + extra, result);
+        if (!*result || certified == digits || attempt == CERTIFY_RETRIES) break;
+        
+        if (!quiet && !tui_mode) {
+            printf("第 %llu 位之后的数字无法由误差半径确认，多算 %llu 位重新计算\n",
+                   (unsigned long long)certified, (unsigned long long)(CERTIFY_RETRY_DIGITS << (attempt + 1)));
+        }
+        free(*result);
+        *result = NULL;
+        certify_retries++;
+    }
+    if (!*result) return 0;
+    
+    if (certified < digits) {
+        fprintf(stderr, "警告: 只有前 %llu 位能由误差半径确认，只输出这些位\n", (unsigned long long)certified);
+    }
+    (*result)[certified] = '\0';
+    return certified;
+}
+
+/*
+ * 按work位的精度求值，转换 work + CERTIFY_TAIL_DIGITS 位，再用误差半径验证前digits位
+ * 返回值：验证通过的位数；内存不足时返回0，*result为NULL
+ */
+uint64_t evaluate_constant(uint64_t digits, uint64_t work, char **result) {
+    /* 各算法按十进制位数决定项数/迭代次数，非十进制时先折算 */
+    uint64_t decimal_digits = work;
+    if (output_base != 10) {
+        decimal_digits = (uint64_t)ceil(work * log10((double)output_base)) + 1;
+    }
+    
     /* 
-     * 设置计算精度
-     * 我们需要比请求的位数更高的精度来确保准确性
-     * log2(10) ≈ 3.322，额外增加10000位作为安全余量
+     * 设置计算精度：按输出进制折算的二进制位数，
+     * 加上由所选算法的舍入误差推出的保护位数（见 guard_bits）
      */
-    mpf_set_default_prec(digits * 3.322 + 10000);
+    mp_bitcnt_t prec = base_digits_to_bits(work, output_base) + guard_bits(decimal_digits);
+    mpf_set_default_prec(prec);
+    
+    /* 求值之后的收尾和转换的预测开销，用于估计剩余时间 */
+    double bits = (double)mpf_get_default_prec();
+    double finish = ETA_FINISH_MULS * mul_work(bits);
+    double convert = ((output_base & (output_base - 1)) == 0
+                      ? ETA_CONVERT_POW2_MULS : ETA_CONVERT_LOG_MULS * log2(bits)) * mul_work(bits);
+    
+    mpf_t x;                    // 存储最终的常数值
+    mpf_init(x);
+    progress_begin_run();
+    progress_post(PROGRESS_START, PHASE_NONE, 0, 0, digits, 0, finish + convert);
+    double start = wall_time();
+    radius_log2 = INFINITY;     // 计算函数没有给出半径时什么都不能确认
+    constants[constant_id].compute(x, decimal_digits);
+    phase_compute = wall_time() - start;
+    certify_radius_log2 = radius_log2;
+    
+    /* 将高精度数值转换为字符串格式 */
+    progress_begin_run();
+    progress_post(PROGRESS_STEP, PHASE_CONVERT, 0, 1, 0, finish, finish + convert);
+    start = wall_time();
+    uint64_t length = work + CERTIFY_TAIL_DIGITS;
+    int ok = mpf_to_fraction_digits(x, length, result);
+    phase_convert = wall_time() - start;
+    mpf_clear(x);
     
+    /* 误差半径加上转换的截断误差小于第known位的一个单位，留出一位余量 */
+    uint64_t certified = 0;
+    if (ok) {
+        double known = floor((-certify_radius_log2 - 2) / log2((double)output_base));
+        if (known > (double)(length - 1)) known = (double)(length - 1);
+        certified = known > 0 ? certify_prefix(*result, digits, (uint64_t)known, output_base) : 0;
+    }
+    progress_post(PROGRESS_DONE, PHASE_CONVERT, 1, 1, certified, convert, finish + convert);
+    return certified;
+}
+
+/* 按 --algo 选择的算法计算π */
+void compute_pi(mpf_t pi, uint64_t digits) {
+    if (pi_algorithm == ALGO_CHUDNOVSKY) {
+        compute_pi_chudnovsky(pi, digits);
+    } else {
+        compute_pi_gauss_legendre(pi, digits);
+    }
+}
+
+/* 解析 --constant 参数，成功返回0 */
+int parse_constant(const char *name) {
+    for (size_t i = 0; i < sizeof(constants) / sizeof(constants[0]); i++) {
+        if (strcmp(name, constants[i].option) == 0) {
+            constant_id = (int)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* 解析 --algo 参数，成功返回0 */
+int parse_algorithm(const char *name) {
+    if (strcmp(name, "gl") == 0 || strcmp(name, "gauss-legendre") == 0) {
+        pi_algorithm = ALGO_GAUSS_LEGENDRE;
+    } else if (strcmp(name, "chudnovsky") == 0 || strcmp(name, "chud") == 0) {
+        pi_algorithm = ALGO_CHUDNOVSKY;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* 当前算法名称，用于提示信息和结果文件 */
+const char *algorithm_name(void) {
+    if (constants[constant_id].algorithm) return constants[constant_id].algorithm;
+    return pi_algorithm == ALGO_CHUDNOVSKY ? "Chudnovsky" : "Gauss-Legendre";
+}
+
+/*
+ * Gauss-Legendre迭代
+ * 参数说明：
+ *   pi     - 输出，已按默认精度初始化
+ *   digits - 要计算的小数位数（决定迭代次数和进度显示）
+ */
+void compute_pi_gauss_legendre(mpf_t pi, uint64_t digits) {
     /* 声明GMP高精度变量 */
     mpf_t a, b, t, p;           // Gauss-Legendre算法变量
     mpf_t a_next, b_next, t_next; // 下一次迭代的变量
-    mpf_t pi;                   // 存储最终的π值
-    mpf_t temp1, temp2, diff;   // 临时变量
+    mpf_t temp1, temp2;         // 临时变量
     
     /* 初始化所有变量 */
     mpf_init(a);
@@ -260,10 +936,8 @@ uint64_t calculate_pi_digits(uint64_t digits, char **result) {
     mpf_init(a_next);
     mpf_init(b_next);
     mpf_init(t_next);
-    mpf_init(pi);
     mpf_init(temp1);
     mpf_init(temp2);
-    mpf_init(diff);
     
     /* 设置Gauss-Legendre算法的初始值 */
     mpf_set_ui(a, 1);           // a0 = 1
@@ -273,37 +947,56 @@ uint64_t calculate_pi_digits(uint64_t digits, char **result) {
     mpf_set_ui(p, 1);           // p0 = 1
     mpf_set_d(t, 0.25);         // t0 = 1/4
     
+    /* a、b、t 的误差半径（见ball_*）；a0、t0、p 都是精确的 */
+    double ra = -INFINITY, rt = -INFINITY, r1, r2;
+    double rb = ball_round(ball_round(-INFINITY, b), b);  // 开方的截断除以2后与b的一次截断相当，再加上除法的截断
+    
     /* 获取开始时间用于进度显示 */
-    clock_t calc_start = clock();
+    double calc_start = wall_time();
     
     /* 计算需要的迭代次数（Gauss-Legendre算法二次收敛） */
     /* 大约需要 log2(digits) 次迭代 */
     unsigned long required_iterations = (unsigned long)(log2(digits) + 2);
+    double iter_work = ETA_GL_ITER_MULS * mul_work((double)mpf_get_prec(a));
     
     /* Gauss-Legendre算法迭代 */
+    progress_begin_run();
     for (unsigned long i = 0; i < required_iterations; i++) {
         /* 计算下一次迭代的值 */
         // a_next = (a + b) / 2
         mpf_add(temp1, a, b);
+        r1 = ball_round(log2_sum(ra, rb), temp1);
         mpf_div_ui(a_next, temp1, 2);
+        double ra_next = ball_round(r1 - 1, a_next);
         
         // b_next = sqrt(a * b)
+        r1 = ball_mul(a, ra, b, rb);
         mpf_mul(temp1, a, b);
+        r1 = ball_round(r1, temp1);
+        double rb_next = ball_sqrt(temp1, r1);
         mpf_sqrt(b_next, temp1);
+        rb_next = ball_round(rb_next, b_next);
         
         // t_next = t - p * (a_next - a)^2
         mpf_sub(temp1, a_next, a);
+        r1 = ball_round(log2_sum(ra_next, ra), temp1);
+        r2 = ball_mul(temp1, r1, temp1, r1);
         mpf_mul(temp2, temp1, temp1);
+        r2 = ball_round(r2, temp2);
+        r1 = ball_mul(p, -INFINITY, temp2, r2);
         mpf_mul(temp1, p, temp2);
+        r1 = ball_round(r1, temp1);
         mpf_sub(t_next, t, temp1);
+        double rt_next = ball_round(log2_sum(rt, r1), t_next);
         
         // p_next = 2 * p
         mpf_mul_ui(p, p, 2);
+        progress_post(PROGRESS_STEP, PHASE_GL, i + 1, required_iterations, gl_correct_digits(i + 1, digits),
+                      iter_work, iter_work * required_iterations);
         
         /* 每1次迭代检查一次时间，显示2的幂次进度 */
         if (i % 2 == 0) {  // 每2次迭代显示一次进度
-            clock_t now = clock();
-            double elapsed = ((double)(now - calc_start)) / CLOCKS_PER_SEC;
+            double elapsed = wall_time() - calc_start;
             
             /* 显示2的幂次进度，避免重复显示 */
             static uint64_t last_shown = 0;
@@ -311,7 +1004,7 @@ uint64_t calculate_pi_digits(uint64_t digits, char **result) {
                 // Check if we should display this power of two based on iteration count
                 // The relationship is approximately: iteration = log2(power_of_two/128) * 2
                 unsigned long expected_iter = (unsigned long)(log2(power_of_two/128.0) * 2);
-                if (i >= expected_iter && power_of_two > last_shown) {
+                if (!quiet && i >= expected_iter && power_of_two > last_shown) {
                     printf("%6llu位: %8.3f秒\n", 
                            (unsigned long long)power_of_two, elapsed);
                     fflush(stdout);
@@ -325,46 +1018,27 @@ uint64_t calculate_pi_digits(uint64_t digits, char **result) {
         mpf_set(a, a_next);
         mpf_set(b, b_next);
         mpf_set(t, t_next);
+        ra = ra_next;
+        rb = rb_next;
+        rt = rt_next;
     }
     
     /* 计算最终的π值：π ≈ (a + b)^2 / (4 * t) */
     mpf_add(temp1, a, b);
+    r1 = ball_round(log2_sum(ra, rb), temp1);
+    r2 = ball_mul(temp1, r1, temp1, r1);
     mpf_mul(temp2, temp1, temp1);
+    r2 = ball_round(r2, temp2);
     mpf_mul_ui(temp1, t, 4);
+    r1 = ball_round(rt + 2, temp1);
+    double rpi = ball_div(temp2, r2, temp1, r1);
     mpf_div(pi, temp2, temp1);
+    rpi = ball_round(rpi, pi);
     
-    /* 为结果分配内存缓冲区 */
-    *result = malloc(digits + 10);  // 额外空间用于小数点和终止符
-    if (!*result) {  // 内存分配失败
-        /* 清理所有GMP变量，防止内存泄漏 */
-        mpf_clear(a);
-        mpf_clear(b);
-        mpf_clear(t);
-        mpf_clear(p);
-        mpf_clear(a_next);
-        mpf_clear(b_next);
-        mpf_clear(t_next);
-        mpf_clear(pi);
-        mpf_clear(temp1);
-        mpf_clear(temp2);
-        return 0;  // 返回失败
-    }
-    
-    /* 将高精度数值转换为字符串格式 */
-    gmp_snprintf(*result, digits + 10, "%.*Ff", (int)digits+1, pi);
-    
-    /* 
-     * 处理字符串格式：
-     * GMP返回的格式是 "3.1415926..."
-     * 我们需要去掉"3."，只保留小数部分
-     */
-    char *dot = strchr(*result, '.');  // 查找小数点位置
-    if (dot) {
-        /* 将字符串左移，去掉"3."前缀 */
-        memmove(*result, dot + 1, strlen(dot));
-        /* 截断到请求的位数 */
-        (*result)[digits] = '\0';
-    }
+    /* Salamin的截断误差界：π - π_n <= π²·2^(n+4)·e^(-π·2^(n+1)) / AGM(1, 1/√2)²，AGM > 0.8472 */
+    double truncation = 2 * log2(M_PI / 0.8472) + required_iterations + 4
+                        - M_PI * ldexp(1.0, (int)required_iterations + 1) / log(2.0);
+    radius_log2 = log2_sum(truncation, rpi);
     
     /* 清理所有GMP变量，释放内存 */
     mpf_clear(a);
@@ -374,31 +1048,4864 @@ uint64_t calculate_pi_digits(uint64_t digits, char **result) {
     mpf_clear(a_next);
     mpf_clear(b_next);
     mpf_clear(t_next);
-    mpf_clear(pi);
     mpf_clear(temp1);
     mpf_clear(temp2);
-    mpf_clear(diff);
+}
+
+/* 0到35对应的数字字符，与GMP的mpf_get_str一致 */
+const char digit_chars[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+/*
+ * 把n个字节展开成2n个十六进制字符（高半字节在前）
+ * SSSE3下每次处理16字节：拆出高低半字节，用pshufb查表，再交错存回
+ */
+void hex_expand(char *out, const uint8_t *in, size_t n) {
+    size_t i = 0;
+#ifdef __SSSE3__
+    const __m128i table = _mm_loadu_si128((const __m128i *)digit_chars);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        __m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(v, mask));
+        _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+#endif
+    for (; i < n; i++) {
+        out[2 * i] = digit_chars[in[i] >> 4];
+        out[2 * i + 1] = digit_chars[in[i] & 0x0f];
+    }
+}
+
+/*
+ * 2的幂进制（每位 bits_per_digit 个二进制位）：
+ * 直接读取mpf的尾数limb。mpf的值为 0.d[size-1]d[size-2]...d[0] * B^exp，
+ * B = 2^GMP_NUMB_BITS，所以小数部分第j个limb就是 d[size-exp-1-j]。
+ * 把这些limb按大端序排成字节流后按位切分，无需任何大数运算。
+ */
+int mpf_to_pow2_digits(mpf_t x, uint64_t digits, int bits_per_digit, char **result) {
+    const int limb_bytes = GMP_NUMB_BITS / 8;
+    uint64_t limbs = (digits * bits_per_digit + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS + 1;
+    uint8_t *bytes = malloc(limbs * limb_bytes);
+    *result = malloc(digits + 2 * limb_bytes + 1);
+    if (!bytes || !*result) {
+        free(bytes);
+        free(*result);
+        *result = NULL;
+        return 0;
+    }
+    
+    long size = x->_mp_size < 0 ? -x->_mp_size : x->_mp_size;
+    long top = size - x->_mp_exp - 1;  // 小数部分第一个limb的下标
+    for (uint64_t j = 0; j < limbs; j++) {
+        long idx = top - (long)j;
+        mp_limb_t limb = (idx >= 0 && idx < size) ? x->_mp_d[idx] : 0;
+        for (int b = 0; b < limb_bytes; b++) {
+            bytes[j * limb_bytes + b] = (uint8_t)(limb >> (GMP_NUMB_BITS - 8 * (b + 1)));
+        }
+    }
     
-    /* 返回实际计算的位数 */
-    return digits;
+    char *out = *result;
+    if (bits_per_digit == 4) {
+        hex_expand(out, bytes, (digits + 1) / 2);
+    } else {
+        /* 其他2的幂进制：逐位从字节流中取出 bits_per_digit 位 */
+        uint64_t bit = 0;
+        for (uint64_t i = 0; i < digits; i++) {
+            unsigned v = 0;
+            for (int b = 0; b < bits_per_digit; b++, bit++) {
+                v = (v << 1) | ((bytes[bit >> 3] >> (7 - (bit & 7))) & 1);
+            }
+            out[i] = digit_chars[v];
+        }
+    }
+    out[digits] = '\0';
+    free(bytes);
+    return 1;
+}
+
+/*
+ * 其他进制：用mpf_get_str多取一些有效位再截断
+ * exp 是小数点在数字串中的位置，<= 0 时前面补零
+ */
+int mpf_to_base_digits(mpf_t x, uint64_t digits, int base, char **result) {
+    mp_exp_t exp;
+    char *str = mpf_get_str(NULL, &exp, base, digits + 32, x);
+    *result = malloc(digits + 1);
+    if (!str || !*result) {
+        free(*result);
+        *result = NULL;
+        return 0;
+    }
+    
+    size_t len = strlen(str);
+    for (uint64_t i = 0; i < digits; i++) {
+        long pos = (long)exp + (long)i;
+        (*result)[i] = (pos >= 0 && (size_t)pos < len) ? str[pos] : '0';
+    }
+    (*result)[digits] = '\0';
+    
+    void (*free_func)(void *, size_t);
+    mp_get_memory_functions(NULL, NULL, &free_func);
+    free_func(str, len + 1);
+    return 1;
 }
 
 /*
- * 将计算结果保存到文本文件
+ * 将高精度数值的小数部分转换为数字字符串（按 --base 选择的进制）
  * 参数说明：
- *   pi_str - 计算得到的圆周率小数部分字符串
- *   digits - 小数位数
+ *   x      - 要转换的数值
+ *   digits - 保留的小数位数
+ *   result - 输出字符串（调用者负责free）
+ * 返回值：成功返回1，内存不足返回0
  */
-void save_pi_to_file(const char *pi_str, uint64_t digits) {
-    /* 参数检查 */
-    if (!pi_str || digits <= 0) return;
+int mpf_to_fraction_digits(mpf_t x, uint64_t digits, char **result) {
+    /* 2的幂进制直接展开二进制尾数 */
+    int bits_per_digit = 0;
+    while ((1 << bits_per_digit) < output_base) bits_per_digit++;
+    if ((1 << bits_per_digit) == output_base) {
+        return mpf_to_pow2_digits(x, digits, bits_per_digit, result);
+    }
     
-    /* 构造文件名 */
-    char filename[256];
-    if (digits == 0) {  // 持续计算模式
-        snprintf(filename, sizeof(filename), "圆周率_永远.text");
-    } else {
-        snprintf(filename, sizeof(filename), "圆周率_%llu位.text", (unsigned long long)digits);
+    /*
+     * 十进制和其他进制都多转换32位再截断。
+     * 不能只多转一位：GMP转换时会在最后一位四舍五入，
+     * 第digits+1位起是9时进位会一直传到保留的最后一位（如π的第761、762位）
+     */
+    return mpf_to_base_digits(x, digits, output_base, result);
+}
+
+/* 单调墙钟时间（秒），多线程时用它而不是clock()统计耗时 */
+double wall_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* ===== 并行任务调度 ===== */
+
+/*
+ * 一个可并行执行的任务。cost是预测开销（单位随意，只用于比较），
+ * 调度器按开销从大到小分配（LPT），让最后完成的线程尽量同时结束。
+ */
+typedef struct {
+    void (*run)(void *arg);   // 任务函数
+    void *arg;                // 任务参数
+    double cost;              // 预测开销
+} task_t;
+
+/*
+ * 一次 run_tasks 调用中一个L3域的任务队列（不分域时只有一个）。
+ * 本域的线程从头部取大任务，其他域的线程从尾部偷小任务，跨域搬的数据尽量少
+ */
+typedef struct {
+    task_t *tasks;
+    uint64_t range;           // 高32位是头、低32位是尾（不含），用CAS更新
+    char pad[48];             // 各队列不共享缓存行
+} task_queue_t;
+
+typedef struct {
+    task_queue_t *queues;
+    int nqueues;
+    const int *queue_of_domain;  // L3域编号 -> 队列编号（-1表示这个域没有队列）
+    int domain;               // 线程所在的L3域（-1表示不分域）
+    int id;                   // 线程编号，用于累计忙碌时间
+} task_worker_t;
+
+/* 每个线程累计的忙碌时间，以及并行区域累计的墙钟时间 */
+double thread_busy[MAX_THREADS];
+double sched_wall = 0;
+/* 执行的任务数和其中跨L3域偷取的次数（原子累加） */
+uint64_t sched_tasks = 0, sched_cross_steals = 0;
+
+/* 末级缓存（L3）域：每个CPU所在域的编号（-1表示未知），由llc_init从sysfs读出 */
+#define LLC_MAX_DOMAINS 128
+int llc_domain_of[CPU_SETSIZE];
+int llc_domain_count = 0;
+cpu_set_t llc_domain_cpus[LLC_MAX_DOMAINS];  // 每个域的CPU
+int llc_order[CPU_SETSIZE];                  // 不固定CPU时各线程按这个顺序分到各域
+int llc_order_count = 0;
+pthread_once_t llc_once = PTHREAD_ONCE_INIT;
+int task_split_domains(task_t *tasks, size_t count, int workers, task_queue_t *queues, int *queue_of_domain);
+
+int task_cost_cmp(const void *x, const void *y) {
+    double cx = ((const task_t *)x)->cost;
+    double cy = ((const task_t *)y)->cost;
+    return (cx < cy) - (cx > cy);  // 从大到小
+}
+
+/* 从队列头部（from_tail为0）或尾部取一个任务，队列空时返回NULL */
+task_t *task_queue_take(task_queue_t *q, int from_tail) {
+    uint64_t r = __atomic_load_n(&q->range, __ATOMIC_RELAXED);
+    for (;;) {
+        uint32_t head = (uint32_t)(r >> 32), tail = (uint32_t)r;
+        if (head >= tail) return NULL;
+        uint64_t next = from_tail ? r - 1 : r + (1ULL << 32);
+        if (__atomic_compare_exchange_n(&q->range, &r, next, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return &q->tasks[from_tail ? tail - 1 : head];
+        }
+    }
+}
+
+/* 线程所在L3域的队列；线程在创建时就固定在这个域里（见placement_attr），不会换域 */
+int task_home_queue(const task_worker_t *w) {
+    if (w->nqueues <= 1) return 0;
+    int d = w->domain;
+    return d >= 0 && w->queue_of_domain[d] >= 0 ? w->queue_of_domain[d] : w->id % w->nqueues;
+}
+
+void *task_worker_main(void *arg) {
+    task_worker_t *w = arg;
+    progress_slot = w->id;
+    if (w->id) {
+        heartbeat_state(HEARTBEAT_RUN);
+        throttle_begin();
+    }
+    for (;;) {
+        int home = task_home_queue(w);
+        task_t *t = NULL;
+        for (int k = 0; k < w->nqueues && !t; k++) {
+            t = task_queue_take(&w->queues[(home + k) % w->nqueues], k > 0);
+            if (t && k > 0) __atomic_fetch_add(&sched_cross_steals, 1, __ATOMIC_RELAXED);
+        }
+        if (!t) break;
+        heartbeat_task();
+        double start = wall_time();
+        t->run(t->arg);
+        thread_busy[w->id] += wall_time() - start;
+    }
+    heartbeat_state(w->id ? HEARTBEAT_IDLE : HEARTBEAT_WAIT);  // 0号线程接着等其他线程
+    if (w->id) throttle_end();
+    return NULL;
+}
+
+/*
+ * 用 num_threads 个线程执行一组互相独立的任务，全部完成后返回。
+ * 调用者线程本身作为0号线程参与执行。
+ */
+void run_tasks(task_t *tasks, size_t count) {
+    if (count == 0) return;
+    int workers = num_threads < (int)count ? num_threads : (int)count;
+    int limit = __atomic_load_n(&thread_limit, __ATOMIC_RELAXED);
+    if (workers > limit) workers = limit;
+    
+    task_queue_t queues[LLC_MAX_DOMAINS];
+    int queue_of_domain[LLC_MAX_DOMAINS];
+    int nqueues = workers > 1 ? task_split_domains(tasks, count, workers, queues, queue_of_domain) : 0;
+    if (nqueues == 0) {  // 不分域：一个队列，整体按开销从大到小
+        qsort(tasks, count, sizeof(task_t), task_cost_cmp);
+        queues[0].tasks = tasks;
+        queues[0].range = count;
+        nqueues = 1;
+    }
+    __atomic_fetch_add(&sched_tasks, count, __ATOMIC_RELAXED);
+    pthread_t tid[MAX_THREADS];
+    task_worker_t worker[MAX_THREADS];
+    double start = wall_time();
+    
+    for (int i = 0; i < workers; i++) {
+        worker[i].queues = queues;
+        worker[i].nqueues = nqueues;
+        worker[i].queue_of_domain = queue_of_domain;
+        worker[i].domain = nqueues > 1 ? llc_worker_domain(i) : -1;
+        worker[i].id = i;
+    }
+    /* 不固定CPU时调用者线程在这一批任务期间也限制在自己的域里，之后恢复 */
+    cpu_set_t caller_affinity;
+    int repin = !placement_count && worker[0].domain >= 0
+                && pthread_getaffinity_np(pthread_self(), sizeof(caller_affinity), &caller_affinity) == 0;
+    if (repin) pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &llc_domain_cpus[worker[0].domain]);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    for (int i = 1; i < workers; i++) {
+        placement_attr(&attr, i, worker[i].domain);
+        if (pthread_create(&tid[i], &attr, task_worker_main, &worker[i]) != 0) {
+            workers = i;  // 创建失败时由已有线程分担剩余任务
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    int state = heartbeat_state(HEARTBEAT_RUN);
+    task_worker_main(&worker[0]);
+    for (int i = 1; i < workers; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    if (repin) pthread_setaffinity_np(pthread_self(), sizeof(caller_affinity), &caller_affinity);
+    heartbeat_state(state);
+    sched_wall += wall_time() - start;
+}
+
+/* 清零调度统计 */
+void sched_stats_reset(void) {
+    memset(thread_busy, 0, sizeof(thread_busy));
+    sched_wall = 0;
+    sched_tasks = sched_cross_steals = 0;
+}
+
+/* 打印并行效率：所有线程忙碌时间之和 / (线程数 * 并行区域墙钟时间) */
+void sched_stats_report(void) {
+    if (quiet || num_threads <= 1 || sched_wall <= 0) return;
+    double busy = 0;
+    for (int i = 0; i < num_threads; i++) busy += thread_busy[i];
+    printf("并行效率: %.1f%% (%d线程, 并行区域 %.3f 秒, 总空闲 %.3f 秒)\n",
+           100.0 * busy / (num_threads * sched_wall), num_threads,
+           sched_wall, num_threads * sched_wall - busy);
+    if (llc_domain_count > 1) {
+        printf("L3域: %d 个，%llu 个任务中跨域偷取 %llu 次\n", llc_domain_count,
+               (unsigned long long)sched_tasks, (unsigned long long)sched_cross_steals);
+    }
+    if (sched_stats) {
+        for (int i = 0; i < num_threads; i++) {
+            printf("  线程%-3d 忙碌 %8.3f 秒, 空闲 %8.3f 秒\n",
+                   i, thread_busy[i], sched_wall - thread_busy[i]);
+        }
+    }
+}
+
+/* ===== 进度事件与剩余时间估计（--progress-fd、--eta） ===== */
+
+/*
+ * 计算线程只把定长事件写进自己的单生产者环形缓冲区（无锁，满了就丢弃并计数），
+ * 汇报线程定期取出所有缓冲区的事件，按时间排序后格式化成JSON行写到描述符。
+ * 每个调度器线程编号一个缓冲区：同一编号的线程在run_tasks之间会换，
+ * 但任何时刻只有一个生产者，join保证了前后两个生产者之间的可见性。
+ * 每个事件带着这一步的预测开销，汇报线程据此和实测时间估计剩余时间。
+ */
+#define PROGRESS_RING_SIZE 256        // 每个缓冲区的事件数（2的幂）
+#define PROGRESS_INTERVAL_MS 20       // 汇报线程的轮询间隔
+#define PROGRESS_MIN_LEAVES 16        // 输出进度时二分拆分至少拆成的叶子数
+#define ETA_MIN_SAMPLES 3             // 阶段内至少这么多步之后才用实测离散度给区间
+#define ETA_DEFAULT_SPREAD 0.5        // 样本太少时剩余时间的相对误差
+#define ETA_MIN_SPREAD 0.05           // 模型本身的误差，区间不会比它更窄
+#define ETA_TAIL_SPREAD 0.3           // 收尾和转换的开销常数是离线标定的，误差较大
+#define ETA_PRINT_INTERVAL 1.0        // --eta 的打印间隔（秒）
+
+const char *progress_event_names[] = { "start", "step", "done" };
+const char *progress_phase_names[PROGRESS_PHASES] = { "", "gl", "newton", "leaves", "merge", "convert" };
+
+typedef struct {
+    int event;
+    int phase;
+    uint64_t run;             // 所属一轮步骤的序号（同一阶段可能连续跑好几轮，步号各自从1开始）
+    uint64_t step, steps;     // 本阶段第几步、共几步
+    uint64_t digits;          // 已经正确的位数（未知时为0）
+    double work;              // 刚完成这一步的预测开销（mul_work的单位）
+    double total;             // 所在阶段的预测总开销；start事件中是求值收尾和转换的开销
+    double wall, cpu;         // 发生时的墙钟时间和进程CPU时间
+} progress_event_t;
+
+typedef struct {
+    progress_event_t ev[PROGRESS_RING_SIZE];
+    uint64_t head;            // 生产者写入的位置
+    uint64_t tail;            // 汇报线程读到的位置
+    uint64_t dropped;         // 缓冲区满时丢弃的事件数
+    char pad[64];             // 避免相邻缓冲区的计数器共享缓存行
+} progress_ring_t;
+
+progress_ring_t *progress_rings = NULL;
+pthread_t progress_thread;
+int progress_running = 0;     // 汇报线程是否在运行（原子读写）
+uint64_t progress_run = 0;    // 当前一轮步骤的序号（原子读写）
+
+double cpu_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 当前常驻内存（KB） */
+uint64_t resident_kb(void) {
+    unsigned long size, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp) return 0;
+    if (fscanf(fp, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(fp);
+    return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE) / 1024;
+}
+
+/*
+ * 一次bits位乘法的预测开销，剩余时间模型的开销单位
+ * GMP的FFT乘法在10^5到10^7位之间实测约按 n^1.18 增长，比 n*log(n) 快，
+ * 主要是缓存失效，用 n*log2(n)^2 拟合；各步骤的开销都折合成这个单位
+ * （见ETA_*_MULS），一个阶段实测的速率就能外推到更大的乘法和后面的阶段。
+ */
+double mul_work(double bits) {
+    double lg = log2(bits + 2);
+    return bits * lg * lg;
+}
+
+/* Gauss-Legendre迭代n次后的正确位数：误差约为 π²·2^(n+4)·e^(-π·2^(n+1)) */
+uint64_t gl_correct_digits(unsigned long n, uint64_t digits) {
+    double d = M_PI * ldexp(1.0, (int)n + 1) / log(10.0) - (n + 4) * log10(2.0) - 2 * log10(M_PI);
+    if (d <= 0) return 0;
+    return d >= (double)digits ? digits : (uint64_t)d;
+}
+
+void progress_post(int event, int phase, uint64_t step, uint64_t steps, uint64_t digits,
+                   double work, double total) {
+    heartbeat_beat(phase, step, steps);
+    if (!progress_rings || progress_slot >= num_threads) return;
+    progress_ring_t *r = &progress_rings[progress_slot];
+    uint64_t head = r->head;  // 只有本线程写head
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= PROGRESS_RING_SIZE) {
+        __atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);  // 汇报线程同时在读
+        return;
+    }
+    progress_event_t *e = &r->ev[head % PROGRESS_RING_SIZE];
+    e->event = event;
+    e->phase = phase;
+    e->run = __atomic_load_n(&progress_run, __ATOMIC_RELAXED);
+    e->step = step;
+    e->steps = steps;
+    e->digits = digits;
+    e->work = work;
+    e->total = total;
+    e->wall = wall_time();
+    e->cpu = cpu_time();
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * 开始新的一轮步骤：由发起这一轮的线程在分派任务之前调用，
+ * 之后这一轮所有线程发布的事件都带着新的序号
+ */
+void progress_begin_run(void) {
+    __atomic_add_fetch(&progress_run, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * 按（轮次，步号，时间）排序，是全序：
+ * 同一轮内按步号排（叶子的步号在任务完成时原子领取，与取时间戳之间
+ * 可能被别的线程插队），不同轮之间不会因为步号都从1开始而交错
+ */
+int progress_event_cmp(const void *x, const void *y) {
+    const progress_event_t *a = x, *b = y;
+    if (a->run != b->run) return (a->run > b->run) - (a->run < b->run);
+    if (a->step != b->step) return (a->step > b->step) - (a->step < b->step);
+    return (a->wall > b->wall) - (a->wall < b->wall);
+}
+
+/*
+ * 汇报线程的状态，用于估计剩余时间
+ * 阶段指一段连续、开销可预测的计算：一轮Gauss-Legendre或牛顿迭代、
+ * 一次二分拆分（叶子和各层合并）、收尾加转换。
+ */
+typedef struct {
+    double origin, origin_cpu;        // 本次计算开始的墙钟时间和CPU时间
+    double last;                      // 上一个事件的时间
+    uint64_t target;                  // 目标位数
+    double tail;                      // 求值收尾和转换的预测开销
+    double done;                      // 本次计算已完成的预测开销
+    int stage;                        // 当前阶段开始时的计算阶段
+    uint64_t run;                     // 当前阶段的轮次
+    double stage_start, stage_total, stage_done;
+    int samples;                      // 本阶段每步实测速率（秒/开销）的个数、均值和平方差和
+    double rate_mean, rate_m2;
+    double printed;                   // --eta 上次打印的时间
+} progress_state_t;
+
+/*
+ * 估计剩余时间及约95%的区间：
+ * 本阶段剩下的开销按本阶段实测的墙钟速率外推（其中已包含并行效率），
+ * 区间取每步速率均值的两倍标准误差；之后的收尾和转换是单线程的，
+ * 按整个计算每单位开销的CPU时间外推。
+ */
+void progress_eta(const progress_state_t *st, const progress_event_t *e, double *mid, double *lo, double *hi) {
+    double left = st->stage_total - st->stage_done;
+    if (left < 0) left = 0;
+    double cpu_rate = (e->cpu - st->origin_cpu) / st->done;
+    if (st->stage == PHASE_CONVERT) {
+        /* 只剩转换：收尾一步的开销因常数而异，不足以标定，直接用CPU速率 */
+        *mid = left * cpu_rate;
+        *lo = *mid * (1 - ETA_TAIL_SPREAD);
+        *hi = *mid * (1 + ETA_TAIL_SPREAD);
+        return;
+    }
+    double stage = left * (e->wall - st->stage_start) / st->stage_done;
+    double spread = ETA_DEFAULT_SPREAD;
+    if (st->samples >= ETA_MIN_SAMPLES && st->rate_mean > 0) {
+        spread = 2 * sqrt(st->rate_m2 / (st->samples - 1) / st->samples) / st->rate_mean;
+        if (spread < ETA_MIN_SPREAD) spread = ETA_MIN_SPREAD;
+    }
+    *mid = stage;
+    *lo = spread < 1 ? stage * (1 - spread) : 0;
+    *hi = stage * (1 + spread);
+    {
+        double tail = st->tail * cpu_rate;
+        *mid += tail;
+        *lo += tail * (1 - ETA_TAIL_SPREAD);
+        *hi += tail * (1 + ETA_TAIL_SPREAD);
+    }
+}
+
+/* 用一个事件更新阶段和速率统计 */
+void progress_account(progress_state_t *st, const progress_event_t *e) {
+    if (e->event == PROGRESS_START) {
+        st->origin = st->last = st->printed = e->wall;
+        st->origin_cpu = e->cpu;
+        st->target = e->digits;
+        st->tail = e->total;
+        st->done = 0;
+        st->stage = PHASE_NONE;
+        st->stage_done = 0;
+        return;
+    }
+    /* 合并层接着同一次二分拆分的叶子；其他阶段换了或换了一轮就是新阶段 */
+    if (e->event == PROGRESS_STEP && e->phase != PHASE_MERGE
+        && (e->phase != st->stage || e->run != st->run)) {
+        st->stage = e->phase;
+        st->run = e->run;
+        st->stage_start = st->last;
+        st->stage_total = e->total;
+        st->stage_done = 0;
+        st->samples = 0;
+        st->rate_mean = st->rate_m2 = 0;
+    }
+    st->stage_done += e->work;
+    st->done += e->work;
+    if (e->work > 0) {
+        /* 并行的叶子按步号排序，时间可能不单调 */
+        double rate = (e->wall > st->last ? e->wall - st->last : 0) / e->work;
+        double delta = rate - st->rate_mean;
+        st->samples++;
+        st->rate_mean += delta / st->samples;
+        st->rate_m2 += delta * (rate - st->rate_mean);
+    }
+    if (e->wall > st->last) st->last = e->wall;
+}
+
+/* 格式化一个事件并写出；--eta 时按间隔在标准错误上打印剩余时间 */
+void progress_emit(progress_state_t *st, const progress_event_t *e, uint64_t dropped) {
+    progress_account(st, e);
+    int have_eta = e->event == PROGRESS_STEP && st->stage_done > 0;
+    double eta = 0, eta_lo = 0, eta_hi = 0;
+    if (have_eta) progress_eta(st, e, &eta, &eta_lo, &eta_hi);
+    
+    if (show_eta && have_eta && e->wall - st->printed >= ETA_PRINT_INTERVAL) {
+        double left = st->stage_total - st->stage_done;
+        if (left < 0) left = 0;
+        if (st->stage != PHASE_CONVERT) left += st->tail;
+        fprintf(stderr, "进度 %5.1f%%，预计剩余 %.1f 秒（%.1f 到 %.1f 秒）\n",
+                100.0 * st->done / (st->done + left), eta, eta_lo, eta_hi);
+        st->printed = e->wall;
+    }
+    if (progress_fd < 0) return;
+    
+    char line[512];
+    int n = snprintf(line, sizeof(line), "{\"event\":\"%s\"", progress_event_names[e->event]);
+    if (e->phase != PHASE_NONE) {
+        n += snprintf(line + n, sizeof(line) - n, ",\"phase\":\"%s\",\"step\":%llu,\"steps\":%llu",
+                      progress_phase_names[e->phase], (unsigned long long)e->step, (unsigned long long)e->steps);
+    }
+    n += snprintf(line + n, sizeof(line) - n, ",\"digits\":%llu,\"target\":%llu,\"wall\":%.3f,"
+                  "\"cpu\":%.3f,\"rss_kb\":%llu",
+                  (unsigned long long)(e->digits < st->target ? e->digits : st->target),
+                  (unsigned long long)st->target, e->wall - st->origin, e->cpu,
+                  (unsigned long long)resident_kb());
+    if (have_eta) {
+        n += snprintf(line + n, sizeof(line) - n, ",\"eta\":%.3f,\"eta_lo\":%.3f,\"eta_hi\":%.3f",
+                      eta, eta_lo, eta_hi);
+    }
+    if (e->event == PROGRESS_DONE) {
+        n += snprintf(line + n, sizeof(line) - n, ",\"dropped\":%llu", (unsigned long long)dropped);
+    }
+    n += snprintf(line + n, sizeof(line) - n, "}\n");
+    if (write(progress_fd, line, (size_t)n) < 0) {
+        progress_fd = -1;  // 对端已关闭，不再输出
+    }
+}
+
+/* 取出所有缓冲区中的事件，按时间顺序输出，返回取出的事件数 */
+size_t progress_drain(progress_state_t *st, progress_event_t *batch) {
+    size_t count = 0;
+    uint64_t dropped = 0;
+    for (int i = 0; i < num_threads; i++) {
+        progress_ring_t *r = &progress_rings[i];
+        uint64_t tail = r->tail;
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        for (; tail < head; tail++) batch[count++] = r->ev[tail % PROGRESS_RING_SIZE];
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+        dropped += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    }
+    qsort(batch, count, sizeof(progress_event_t), progress_event_cmp);
+    for (size_t i = 0; i < count; i++) progress_emit(st, &batch[i], dropped);
+    return count;
+}
+
+void *progress_main(void *arg) {
+    (void)arg;
+    progress_state_t st;
+    memset(&st, 0, sizeof(st));
+    progress_event_t *batch = malloc((size_t)num_threads * PROGRESS_RING_SIZE * sizeof(progress_event_t));
+    if (!batch) return NULL;
+    struct timespec interval = { 0, PROGRESS_INTERVAL_MS * 1000000L };
+    while (__atomic_load_n(&progress_running, __ATOMIC_ACQUIRE)) {
+        progress_drain(&st, batch);
+        nanosleep(&interval, NULL);
+    }
+    progress_drain(&st, batch);  // 停止前的最后一批
+    free(batch);
+    return NULL;
+}
+
+void progress_start(void) {
+    if (progress_fd < 0 && !show_eta) return;
+    progress_rings = calloc((size_t)num_threads, sizeof(progress_ring_t));
+    if (!progress_rings) return;
+    progress_running = 1;
+    if (pthread_create(&progress_thread, NULL, progress_main, NULL) != 0) {
+        progress_running = 0;
+        free(progress_rings);
+        progress_rings = NULL;
+    }
+}
+
+void progress_stop(void) {
+    if (!progress_rings) return;
+    __atomic_store_n(&progress_running, 0, __ATOMIC_RELEASE);
+    pthread_join(progress_thread, NULL);
+    free(progress_rings);
+    progress_rings = NULL;
+}
+
+/* ===== 二分拆分求级数（π、e等常数共用） ===== */
+
+/*
+ * 求和 S = Σ a(k) * Π_{j<=k} p(j)/q(j) 时，把第k项记为
+ *   P(k) = p(k), Q(k) = q(k), T(k) = a(k) * p(k)
+ * 对区间 [a, b) 递归二分，合并规则：
+ *   P = P1*P2, Q = Q1*Q2, T = T1*Q2 + P1*T2
+ * 最后 S = T/Q，全程只有整数乘法，便于并行。
+ *
+ * P1与Q2之间常有大量公因子（全是小素数），把它们约掉后
+ * P、Q、T的体积可缩小10%~20%，大数乘法的开销也随之下降。
+ * 为此在底层用筛出的最小质因子表记录每个节点的质因数分解，
+ * 合并前先求出公因子并从两侧整除掉。
+ */
+/* 离根节点不足这么多层的合并不做约简：顶层质因数表很长，约掉的比例却很小 */
+#define GCD_TOP_LEVELS 4
+
+/* 质因数分解表示：按素数升序存放的（素数, 指数）对 */
+typedef struct {
+    uint32_t *prime;
+    uint32_t *power;
+    size_t count;
+    size_t capacity;
+} fac_t;
+
+/* 二分拆分树的一个节点 */
+typedef struct {
+    mpz_t p, q, t;
+    fac_t fp, fq;   // p、q 的质因数分解（只在需要约简的层维护）
+} bs_node_t;
+
+/* 一个可以二分拆分的级数 */
+typedef struct bs_series bs_series_t;
+struct bs_series {
+    /* 填写第k项的P、Q、T；track非0时同时填写fp、fq */
+    void (*leaf)(const bs_series_t *s, bs_node_t *node, uint64_t k, int track);
+    /* 预测 [a, b) 这段的Q有多少位，用于切分和调度 */
+    double (*bits)(const bs_series_t *s, uint64_t a, uint64_t b);
+    /* 第k项的Q有多少位（bits对b的导数） */
+    double (*term_bits)(const bs_series_t *s, double k);
+    /* 只取前n项（k < n）时余项绝对值的上界（log2），按T/Q所在的尺度 */
+    double (*tail)(const bs_series_t *s, uint64_t n);
+    int factorable;           // P、Q是否只含小素因子（可以做公因子约简）
+    uint64_t sieve_factor;    // 叶子上待分解的最大数约为 sieve_factor * k
+    uint64_t x;               // 级数参数（如arctanh(1/x)中的x），不用时为0
+};
+
+/* 奇数的最小质因子表：sieve_spf[n/2] 是奇数n的最小质因子 */
+uint32_t *sieve_spf = NULL;
+uint64_t sieve_limit = 0;
+/* 本次计算约简掉的公因子总位数 */
+uint64_t gcd_removed_bits = 0;
+
+/* 筛出不超过limit的奇数的最小质因子，失败返回0 */
+int sieve_init(uint64_t limit) {
+    sieve_spf = calloc(limit / 2 + 1, sizeof(uint32_t));
+    if (!sieve_spf) return 0;
+    sieve_limit = limit;
+    for (uint64_t i = 3; i <= limit; i += 2) {
+        if (sieve_spf[i / 2]) continue;
+        sieve_spf[i / 2] = (uint32_t)i;  // i是素数
+        for (uint64_t j = i * i; j <= limit; j += 2 * i) {
+            if (!sieve_spf[j / 2]) sieve_spf[j / 2] = (uint32_t)i;
+        }
+    }
+    return 1;
+}
+
+void sieve_clear(void) {
+    free(sieve_spf);
+    sieve_spf = NULL;
+    sieve_limit = 0;
+}
+
+void fac_init(fac_t *f) {
+    f->prime = NULL;
+    f->power = NULL;
+    f->count = 0;
+    f->capacity = 0;
+}
+
+void fac_clear(fac_t *f) {
+    free(f->prime);
+    free(f->power);
+    fac_init(f);
+}
+
+void fac_reserve(fac_t *f, size_t capacity) {
+    if (capacity <= f->capacity) return;
+    f->prime = realloc(f->prime, capacity * sizeof(uint32_t));
+    f->power = realloc(f->power, capacity * sizeof(uint32_t));
+    if (!f->prime || !f->power) {
+        fprintf(stderr, "错误: 内存不足\n");
+        exit(1);
+    }
+    f->capacity = capacity;
+}
+
+/* f = f * (primes^powers)，两边都按素数升序 */
+void fac_merge(fac_t *f, const uint32_t *prime, const uint32_t *power, size_t n) {
+    if (n == 0) return;
+    size_t total = f->count + n;
+    uint32_t *np = malloc(total * sizeof(uint32_t));
+    uint32_t *ne = malloc(total * sizeof(uint32_t));
+    if (!np || !ne) {
+        fprintf(stderr, "错误: 内存不足\n");
+        exit(1);
+    }
+    size_t i = 0, j = 0, k = 0;
+    while (i < f->count && j < n) {
+        if (f->prime[i] < prime[j]) {
+            np[k] = f->prime[i]; ne[k++] = f->power[i++];
+        } else if (f->prime[i] > prime[j]) {
+            np[k] = prime[j]; ne[k++] = power[j++];
+        } else {
+            np[k] = prime[j]; ne[k++] = f->power[i++] + power[j++];
+        }
+    }
+    while (i < f->count) { np[k] = f->prime[i]; ne[k++] = f->power[i++]; }
+    while (j < n) { np[k] = prime[j]; ne[k++] = power[j++]; }
+    free(f->prime);
+    free(f->power);
+    f->prime = np;
+    f->power = ne;
+    f->count = k;
+    f->capacity = total;
+}
+
+/* f = f * n^e，n先用筛表分解，超出筛表范围时退回试除 */
+void fac_mul_ui(fac_t *f, uint64_t n, uint32_t e) {
+    uint32_t prime[64], power[64];
+    size_t c = 0;
+    if (n > 1 && (n & 1) == 0) {
+        prime[c] = 2;
+        power[c] = 0;
+        while ((n & 1) == 0) { n >>= 1; power[c] += e; }
+        c++;
+    }
+    while (n > 1) {
+        uint64_t d;
+        if (n <= sieve_limit) {
+            d = sieve_spf[n / 2];
+        } else {
+            for (d = 3; d * d <= n && n % d; d += 2) {}
+            if (d * d > n) d = n;
+        }
+        prime[c] = (uint32_t)d;
+        power[c] = 0;
+        while (n % d == 0) { n /= d; power[c] += e; }
+        c++;
+    }
+    fac_merge(f, prime, power, c);
+}
+
+/* r = 质因数表中 [lo, hi) 这一段的乘积，用乘积树保持两边大小均衡 */
+void fac_product(mpz_t r, const uint32_t *prime, const uint32_t *power, size_t lo, size_t hi) {
+    if (hi - lo <= 8) {
+        mpz_t pe;
+        mpz_init(pe);
+        mpz_set_ui(r, 1);
+        for (size_t i = lo; i < hi; i++) {
+            mpz_ui_pow_ui(pe, prime[i], power[i]);
+            mpz_mul(r, r, pe);
+        }
+        mpz_clear(pe);
+        return;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    mpz_t right;
+    mpz_init(right);
+    fac_product(r, prime, power, lo, mid);
+    fac_product(right, prime, power, mid, hi);
+    mpz_mul(r, r, right);
+    mpz_clear(right);
+}
+
+/*
+ * 约掉x与y的公因子：x、y分别带有分解表fx、fy
+ * 返回约掉的公因子位数
+ */
+uint64_t fac_remove_gcd(mpz_t x, fac_t *fx, mpz_t y, fac_t *fy) {
+    size_t n = fx->count < fy->count ? fx->count : fy->count;
+    if (n == 0) return 0;
+    uint32_t *prime = malloc(n * sizeof(uint32_t));
+    uint32_t *power = malloc(n * sizeof(uint32_t));
+    if (!prime || !power) {
+        fprintf(stderr, "错误: 内存不足\n");
+        exit(1);
+    }
+    
+    /* 求公共部分，并从两边的分解表中扣除 */
+    size_t i = 0, j = 0, c = 0, ki = 0, kj = 0;
+    while (i < fx->count && j < fy->count) {
+        if (fx->prime[i] < fy->prime[j]) {
+            fx->prime[ki] = fx->prime[i]; fx->power[ki++] = fx->power[i++];
+        } else if (fx->prime[i] > fy->prime[j]) {
+            fy->prime[kj] = fy->prime[j]; fy->power[kj++] = fy->power[j++];
+        } else {
+            uint32_t e = fx->power[i] < fy->power[j] ? fx->power[i] : fy->power[j];
+            prime[c] = fx->prime[i];
+            power[c++] = e;
+            if (fx->power[i] > e) { fx->prime[ki] = fx->prime[i]; fx->power[ki++] = fx->power[i] - e; }
+            if (fy->power[j] > e) { fy->prime[kj] = fy->prime[j]; fy->power[kj++] = fy->power[j] - e; }
+            i++;
+            j++;
+        }
+    }
+    while (i < fx->count) { fx->prime[ki] = fx->prime[i]; fx->power[ki++] = fx->power[i++]; }
+    while (j < fy->count) { fy->prime[kj] = fy->prime[j]; fy->power[kj++] = fy->power[j++]; }
+    fx->count = ki;
+    fy->count = kj;
+    
+    uint64_t bits = 0;
+    if (c > 0) {
+        mpz_t g;
+        mpz_init(g);
+        fac_product(g, prime, power, 0, c);
+        mpz_divexact(x, x, g);
+        mpz_divexact(y, y, g);
+        bits = mpz_sizeinbase(g, 2) - 1;
+        mpz_clear(g);
+    }
+    free(prime);
+    free(power);
+    return bits;
+}
+
+void bs_node_init(bs_node_t *n) {
+    mpz_init(n->p);
+    mpz_init(n->q);
+    mpz_init(n->t);
+    fac_init(&n->fp);
+    fac_init(&n->fq);
+}
+
+void bs_node_clear(bs_node_t *n) {
+    mpz_clear(n->p);
+    mpz_clear(n->q);
+    mpz_clear(n->t);
+    fac_clear(&n->fp);
+    fac_clear(&n->fq);
+}
+
+/*
+ * 对 [a, b) 范围的项做二分拆分，结果存入node
+ * need_p - 是否需要P（最右侧一条链上的P用不到，可以省掉）
+ * level  - 距根节点的层数，决定是否维护质因数分解
+ * reduce - 本次求值是否做公因子约简（筛表已经准备好）
+ */
+void bs_series(const bs_series_t *s, bs_node_t *node, uint64_t a, uint64_t b, int need_p, int level, int reduce) {
+    int track = reduce && level >= GCD_TOP_LEVELS;
+    
+    if (b - a == 1) {
+        if (track) {
+            node->fp.count = 0;
+            node->fq.count = 0;
+        }
+        s->leaf(s, node, a, track);
+        return;
+    }
+    
+    uint64_t mid = a + (b - a) / 2;
+    bs_node_t right;
+    bs_node_init(&right);
+    bs_series(s, node, a, mid, 1, level + 1, reduce);
+    bs_series(s, &right, mid, b, need_p, level + 1, reduce);
+    
+    /* 合并前先约掉 P1 与 Q2 的公因子 */
+    if (track) {
+        uint64_t bits = fac_remove_gcd(node->p, &node->fp, right.q, &right.fq);
+        __atomic_fetch_add(&gcd_removed_bits, bits, __ATOMIC_RELAXED);
+    }
+    
+    /* T = T1*Q2 + P1*T2 */
+    mpz_mul(node->t, node->t, right.q);
+    mpz_mul(right.t, right.t, node->p);
+    mpz_add(node->t, node->t, right.t);
+    /* Q = Q1*Q2 */
+    mpz_mul(node->q, node->q, right.q);
+    /* P = P1*P2 */
+    if (need_p) mpz_mul(node->p, node->p, right.p);
+    
+    if (track) {
+        fac_merge(&node->fq, right.fq.prime, right.fq.power, right.fq.count);
+        if (need_p) fac_merge(&node->fp, right.fp.prime, right.fp.power, right.fp.count);
+    }
+    bs_node_clear(&right);
+}
+
+/* Σ_{k=a}^{b-1} log2(αk+β)，用lgamma求和，避免逐项累加 */
+double sum_log2_linear(uint64_t a, uint64_t b, double alpha, double beta) {
+    double shift = beta / alpha;
+    return (double)(b - a) * log2(alpha)
+           + (lgamma((double)b + shift) - lgamma((double)a + shift)) / log(2.0);
+}
+
+/* 预测 [a, b) 子树的开销：每层总位数相近，每层乘法约 n*log(n) */
+double bs_cost(const bs_series_t *s, uint64_t a, uint64_t b) {
+    double bits = s->bits(s, a, b);
+    return bits * log2(bits + 2) * log2((double)(b - a) + 1);
+}
+
+/* 叶子子树的预测开销：逐层累计，第l层有2^l个节点，每个约占总位数的1/2^l */
+double bs_leaf_work(const bs_series_t *s, uint64_t a, uint64_t b) {
+    double bits = s->bits(s, a, b), work = 0;
+    for (double nodes = 1; nodes < (double)(b - a); nodes *= 2) {
+        work += ETA_MERGE_MULS * nodes * mul_work(bits / nodes);
+    }
+    return work;
+}
+
+/*
+ * 选择 [a, b) 的切分点
+ * 越靠后的项系数越大，取中点会让右半边明显更重；
+ * skew模式下用牛顿法找两边预测位数相等的点
+ */
+uint64_t bs_split_point(const bs_series_t *s, uint64_t a, uint64_t b) {
+    uint64_t mid = a + (b - a) / 2;
+    if (!skew_split || b - a < 4) return mid;
+    double m = (double)mid;
+    for (int i = 0; i < 4; i++) {
+        uint64_t mi = (uint64_t)m;
+        double diff = s->bits(s, a, mi) - s->bits(s, mi, b);
+        double slope = 2.0 * s->term_bits(s, m);  // d(diff)/dm
+        m -= diff / slope;
+        if (m < a + 1) m = a + 1;
+        if (m > b - 1) m = b - 1;
+    }
+    return (uint64_t)m;
+}
+
+/* 叶子任务：串行计算一棵子树 */
+typedef struct {
+    const bs_series_t *series;
+    bs_node_t *node;
+    uint64_t a, b;
+    int need_p, level, reduce;
+} bs_leaf_task_t;
+
+/* 已完成的叶子数，由各工作线程原子递增，用于进度事件 */
+uint64_t bs_leaves_done = 0, bs_leaves_total = 0;
+/* 叶子和各层合并的预测总开销，用于估计剩余时间 */
+double bs_work_total = 0;
+
+void bs_leaf_run(void *arg) {
+    bs_leaf_task_t *t = arg;
+    bs_series(t->series, t->node, t->a, t->b, t->need_p, t->level, t->reduce);
+    uint64_t done = __atomic_add_fetch(&bs_leaves_done, 1, __ATOMIC_RELAXED);
+    progress_post(PROGRESS_STEP, PHASE_LEAVES, done, bs_leaves_total, 0,
+                  bs_leaf_work(t->series, t->a, t->b), bs_work_total);
+}
+
+/* 合并任务：左右两个节点，合并结果留在左节点 */
+typedef struct {
+    bs_node_t *left, *right;
+    int need_p, track;
+} bs_merge_task_t;
+
+void bs_merge_gcd_run(void *arg) {
+    bs_merge_task_t *m = arg;
+    uint64_t bits = fac_remove_gcd(m->left->p, &m->left->fp, m->right->q, &m->right->fq);
+    __atomic_fetch_add(&gcd_removed_bits, bits, __ATOMIC_RELAXED);
+}
+
+/* 合并中的一次大数乘法 r = x * y；多个乘法只读共享操作数，可并行 */
+typedef struct {
+    mpz_ptr r;
+    mpz_srcptr x, y;
+} bs_mul_task_t;
+
+void bs_mul_run(void *arg) {
+    bs_mul_task_t *m = arg;
+    mpz_mul(m->r, m->x, m->y);
+}
+
+double bs_mul_cost(mpz_srcptr x, mpz_srcptr y) {
+    double n = (double)(mpz_size(x) + mpz_size(y));
+    return n * log2(n + 2);
+}
+
+void bs_merge_finish_run(void *arg) {
+    bs_merge_task_t *m = arg;
+    bs_node_t *l = m->left, *r = m->right;
+    mpz_add(l->t, l->t, r->t);          // T = T1*Q2 + P1*T2
+    if (m->need_p) mpz_swap(l->p, r->p);  // P1*P2 暂存在右节点
+    if (m->track) {
+        fac_merge(&l->fq, r->fq.prime, r->fq.power, r->fq.count);
+        if (m->need_p) fac_merge(&l->fp, r->fp.prime, r->fp.power, r->fp.count);
+    }
+    bs_node_clear(r);
+}
+
+/* 递归地把 [a, b) 切成 2^depth 个叶子任务，按从左到右的顺序写入 out */
+void bs_plan(const bs_series_t *s, bs_leaf_task_t *out, size_t *count,
+             uint64_t a, uint64_t b, int level, int depth) {
+    if (level == depth) {
+        out[*count].series = s;
+        out[*count].a = a;
+        out[*count].b = b;
+        out[*count].level = level;
+        (*count)++;
+        return;
+    }
+    uint64_t mid = bs_split_point(s, a, b);
+    bs_plan(s, out, count, a, mid, level + 1, depth);
+    bs_plan(s, out, count, mid, b, level + 1, depth);
+}
+
+/* 合并一层的预测开销 */
+double bs_level_work(const bs_series_t *s, const bs_leaf_task_t *leaf, size_t n, size_t stride) {
+    double work = 0;
+    for (size_t i = 0; i + stride < n; i += 2 * stride) {
+        work += ETA_MERGE_MULS * mul_work(s->bits(s, leaf[i].a, leaf[i + 2 * stride - 1].b));
+    }
+    return work;
+}
+
+/*
+ * 并行二分拆分 [a, b)，结果存入root
+ * 先把树的上部切成若干叶子子树交给线程池，再逐层向上合并：
+ * 每层先并行约简公因子，再把所有大数乘法作为独立任务并行执行。
+ */
+void bs_parallel(const bs_series_t *s, bs_node_t *root, uint64_t a, uint64_t b, int reduce) {
+    /*
+     * 叶子数取线程数的4倍左右，方便按开销做负载均衡。
+     * 输出进度时单线程也拆成至少16个叶子，拆分点与递归相同，结果和开销都不变
+     */
+    unsigned long want = 4UL * num_threads;
+    if (progress_rings && want < PROGRESS_MIN_LEAVES) want = PROGRESS_MIN_LEAVES;
+    int depth = 0;
+    while ((num_threads > 1 || progress_rings) && (1UL << depth) < want
+           && (b - a) >> (depth + 1) >= 16) {
+        depth++;
+    }
+    if (depth == 0) {
+        bs_series(s, root, a, b, 0, 0, reduce);
+        return;
+    }
+    
+    size_t leaves = 0, n = 1UL << depth;
+    bs_leaf_task_t *leaf = malloc(n * sizeof(bs_leaf_task_t));
+    bs_node_t *node = malloc(n * sizeof(bs_node_t));
+    task_t *tasks = malloc(4 * n * sizeof(task_t));
+    bs_merge_task_t *merge = malloc(n * sizeof(bs_merge_task_t));
+    bs_mul_task_t *mul = malloc(4 * n * sizeof(bs_mul_task_t));
+    if (!leaf || !node || !tasks || !merge || !mul) {
+        fprintf(stderr, "错误: 内存不足\n");
+        exit(1);
+    }
+    
+    bs_plan(s, leaf, &leaves, a, b, 0, depth);
+    bs_leaves_done = 0;
+    bs_leaves_total = n;
+    for (size_t i = 0; i < n; i++) {
+        bs_node_init(&node[i]);
+        leaf[i].node = &node[i];
+        leaf[i].need_p = (i != n - 1);  // 最右侧的P用不到
+        leaf[i].reduce = reduce;
+        tasks[i].run = bs_leaf_run;
+        tasks[i].arg = &leaf[i];
+        tasks[i].cost = bs_cost(s, leaf[i].a, leaf[i].b);
+    }
+    bs_work_total = 0;
+    for (size_t i = 0; i < n; i++) bs_work_total += bs_leaf_work(s, leaf[i].a, leaf[i].b);
+    for (size_t stride = 1; stride < n; stride *= 2) bs_work_total += bs_level_work(s, leaf, n, stride);
+    progress_begin_run();
+    run_tasks(tasks, n);
+    
+    /* 逐层合并：stride 是同层相邻两个节点在 node[] 中的距离 */
+    progress_begin_run();
+    for (size_t stride = 1; stride < n; stride *= 2) {
+        int level = depth - 1;
+        for (size_t st = stride; st > 1; st /= 2) level--;
+        int track = reduce && level >= GCD_TOP_LEVELS;
+        size_t merges = 0, muls = 0;
+        
+        for (size_t i = 0; i + stride < n; i += 2 * stride) {
+            bs_merge_task_t *m = &merge[merges++];
+            m->left = &node[i];
+            m->right = &node[i + stride];
+            m->need_p = (i + 2 * stride < n);
+            m->track = track;
+        }
+        
+        if (track) {
+            for (size_t j = 0; j < merges; j++) {
+                tasks[j].run = bs_merge_gcd_run;
+                tasks[j].arg = &merge[j];
+                tasks[j].cost = (double)mpz_size(merge[j].right->q);
+            }
+            run_tasks(tasks, merges);
+        }
+        
+        for (size_t j = 0; j < merges; j++) {
+            bs_node_t *l = merge[j].left, *r = merge[j].right;
+            bs_mul_task_t m4[4] = {
+                { l->t, l->t, r->q },   // T1*Q2
+                { r->t, r->t, l->p },   // P1*T2
+                { l->q, l->q, r->q },   // Q1*Q2
+                { r->p, l->p, r->p },   // P1*P2
+            };
+            for (int k = 0; k < (merge[j].need_p ? 4 : 3); k++) {
+                mul[muls] = m4[k];
+                tasks[muls].run = bs_mul_run;
+                tasks[muls].arg = &mul[muls];
+                tasks[muls].cost = bs_mul_cost(m4[k].x, m4[k].y);
+                muls++;
+            }
+        }
+        run_tasks(tasks, muls);
+        
+        for (size_t j = 0; j < merges; j++) {
+            tasks[j].run = bs_merge_finish_run;
+            tasks[j].arg = &merge[j];
+            tasks[j].cost = (double)mpz_size(merge[j].left->t);
+        }
+        run_tasks(tasks, merges);
+        progress_post(PROGRESS_STEP, PHASE_MERGE, (uint64_t)(depth - level), (uint64_t)depth, 0,
+                      bs_level_work(s, leaf, n, stride), bs_work_total);
+    }
+    
+    /* 结果在 node[0] 中 */
+    mpz_swap(root->p, node[0].p);
+    mpz_swap(root->q, node[0].q);
+    mpz_swap(root->t, node[0].t);
+    bs_node_clear(&node[0]);
+    free(leaf);
+    free(node);
+    free(tasks);
+    free(merge);
+    free(mul);
+}
+
+/*
+ * 求级数在 [a, b) 上的 P、Q、T（a >= 1，第0项由调用者处理）
+ * 负责筛表、调度统计和约简效果的输出。筛表分配失败时只有这一次求值不约简，
+ * 持续计算和压力测试的下一轮照常尝试
+ */
+void bs_evaluate(const bs_series_t *s, bs_node_t *root, uint64_t a, uint64_t b) {
+    int reduce = gcd_reduction && s->factorable;
+    if (reduce && !sieve_init(s->sieve_factor * b + 1)) {
+        fprintf(stderr, "警告: 筛表内存不足，本次计算不做公因子约简\n");
+        reduce = 0;
+    }
+    gcd_removed_bits = 0;
+    sched_stats_reset();
+    
+    bs_parallel(s, root, a, b, reduce);
+    sched_stats_report();
+    
+    if (reduce) {
+        /* 每次约简都让最终的Q和T同样缩小，据此估算约简前的体积 */
+        uint64_t q_bits = mpz_sizeinbase(root->q, 2);
+        uint64_t t_bits = mpz_sizeinbase(root->t, 2);
+        double saved = 100.0 * (double)gcd_removed_bits / (double)(q_bits + gcd_removed_bits);
+        if (!quiet) {
+            printf("公因子约简: Q %llu 位, T %llu 位, 各约掉 %llu 位 (缩小 %.1f%%)\n",
+                   (unsigned long long)q_bits, (unsigned long long)t_bits,
+                   (unsigned long long)gcd_removed_bits, saved);
+        }
+        sieve_clear();
+    }
+}
+
+/*
+ * 使余项上界不超过 2^target 的最少项数（至少2项，[1, n) 非空）
+ * 各级数的tail都随n单调下降，先倍增再二分
+ */
+uint64_t bs_terms(const bs_series_t *s, double target) {
+    uint64_t hi = 2;
+    while (s->tail(s, hi) > target) hi *= 2;
+    uint64_t lo = hi / 2 < 2 ? 2 : hi / 2;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (s->tail(s, mid) > target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* ===== Chudnovsky算法 ===== */
+
+/*
+ * Chudnovsky公式：
+ *   1/π = 12 Σ (-1)^k (6k)! (A + Bk) / ((3k)! (k!)^3 C^(3k+3/2))
+ * 每一项贡献约14.18位小数。相邻两项之比为
+ *   p(k)/q(k) = -(6k-5)(2k-1)(6k-1) / (k^3 C^3/24)
+ * 最后 π = 426880 * sqrt(10005) * Q / (A*Q + T)
+ */
+#define CHUD_A 13591409UL
+#define CHUD_B 545140134UL
+#define CHUD_C3_24 10939058860032000UL   // C^3/24，C = 640320
+
+void chud_leaf(const bs_series_t *s, bs_node_t *node, uint64_t k, int track) {
+    (void)s;
+    /* P(k) = -(6k-5)(2k-1)(6k-1) */
+    mpz_set_ui(node->p, 6 * k - 5);
+    mpz_mul_ui(node->p, node->p, 2 * k - 1);
+    mpz_mul_ui(node->p, node->p, 6 * k - 1);
+    mpz_neg(node->p, node->p);
+    /* Q(k) = k^3 * C^3/24 */
+    mpz_set_ui(node->q, k);
+    mpz_mul_ui(node->q, node->q, k);
+    mpz_mul_ui(node->q, node->q, k);
+    mpz_mul_ui(node->q, node->q, CHUD_C3_24);
+    /* T(k) = P(k) * (A + Bk) */
+    mpz_mul_ui(node->t, node->p, CHUD_A + CHUD_B * k);
+    
+    if (track) {
+        fac_mul_ui(&node->fp, 6 * k - 5, 1);
+        fac_mul_ui(&node->fp, 2 * k - 1, 1);
+        fac_mul_ui(&node->fp, 6 * k - 1, 1);
+        /* C^3/24 = 2^15 * 3^2 * 5^3 * 23^3 * 29^3 */
+        static const uint32_t c_prime[] = {2, 3, 5, 23, 29};
+        static const uint32_t c_power[] = {15, 2, 3, 3, 3};
+        fac_merge(&node->fq, c_prime, c_power, 5);
+        fac_mul_ui(&node->fq, k, 3);
+    }
+}
+
+/* Q = Π k^3 * C^3/24 的位数 */
+double chud_bits(const bs_series_t *s, uint64_t a, uint64_t b) {
+    (void)s;
+    return 3.0 * sum_log2_linear(a, b, 1, 0) + (double)(b - a) * log2((double)CHUD_C3_24);
+}
+
+double chud_term_bits(const bs_series_t *s, double k) {
+    (void)s;
+    return 3.0 * log2(k) + log2((double)CHUD_C3_24);
+}
+
+/*
+ * (6k-5)(2k-1)(6k-1) < 72k^3，相邻两项之比不超过 1728/C^3，
+ * 交错递减级数的余项不超过第一个略去的项 (A + Bn) (1728/C^3)^n
+ */
+double chud_tail(const bs_series_t *s, uint64_t n) {
+    (void)s;
+    return log2((double)CHUD_A + (double)CHUD_B * n) + n * (log2(1728.0) - 3.0 * log2(640320.0));
+}
+
+/* 叶子上要分解的最大数是 6k-1 */
+const bs_series_t chudnovsky_series = { chud_leaf, chud_bits, chud_term_bits, chud_tail, 1, 6, 0 };
+
+/*
+ * Chudnovsky级数
+ * 参数说明：
+ *   pi     - 输出，已按默认精度初始化
+ *   digits - 要计算的小数位数（决定级数项数）
+ */
+void compute_pi_chudnovsky(mpf_t pi, uint64_t digits) {
+    (void)digits;
+    /* A*Q + T 的首项是A，π = 426880 sqrt(10005) / (A + ...) 的相对误差约为余项/A，π < 4 */
+    double scale = 2.0 - log2((double)CHUD_A) + 1.0;
+    uint64_t terms = bs_terms(&chudnovsky_series, -(double)mpf_get_prec(pi) - scale);
+    
+    bs_node_t root;
+    bs_node_init(&root);
+    bs_evaluate(&chudnovsky_series, &root, 1, terms);  // 第0项单独加在最后
+    
+    /* π = 426880 * sqrt(10005) * Q / (A*Q + T) */
+    mpf_t num, den;
+    mpf_init(num);
+    mpf_init(den);
+    mpz_addmul_ui(root.t, root.q, CHUD_A);
+    mpf_sqrt_ui(num, 10005);
+    double rn = ball_round(-INFINITY, num);
+    mpf_mul_ui(num, num, 426880);
+    rn = ball_round(rn + log2(426880.0), num);
+    mpf_set_z(den, root.q);
+    double rd = ball_round(-INFINITY, den);
+    rn = ball_mul(num, rn, den, rd);
+    mpf_mul(num, num, den);
+    rn = ball_round(rn, num);
+    mpf_set_z(den, root.t);
+    rd = ball_round(-INFINITY, den);
+    double rpi = ball_div(num, rn, den, rd);
+    mpf_div(pi, num, den);
+    rpi = ball_round(rpi, pi);
+    radius_log2 = log2_sum(chudnovsky_series.tail(&chudnovsky_series, terms) + scale, rpi);
+    
+    mpf_clear(num);
+    mpf_clear(den);
+    bs_node_clear(&root);
+}
+
+/* ===== 自然常数e ===== */
+
+/*
+ * e = Σ 1/k!，相邻两项之比 p(k)/q(k) = 1/k，a(k) = 1
+ * P恒为1，没有可约的公因子
+ */
+void e_leaf(const bs_series_t *s, bs_node_t *node, uint64_t k, int track) {
+    (void)s;
+    (void)track;
+    mpz_set_ui(node->p, 1);
+    mpz_set_ui(node->q, k);
+    mpz_set_ui(node->t, 1);
+}
+
+double e_bits(const bs_series_t *s, uint64_t a, uint64_t b) {
+    (void)s;
+    return sum_log2_linear(a, b, 1, 0);
+}
+
+double e_term_bits(const bs_series_t *s, double k) {
+    (void)s;
+    return log2(k);
+}
+
+/* Σ_{k>=n} 1/k! < 2/n! */
+double e_tail(const bs_series_t *s, uint64_t n) {
+    (void)s;
+    return 1.0 - lgamma((double)n + 1) / log(2.0);
+}
+
+const bs_series_t e_series = { e_leaf, e_bits, e_term_bits, e_tail, 0, 0, 0 };
+
+/*
+ * 用二分拆分计算e
+ * 参数说明：
+ *   e      - 输出，已按默认精度初始化
+ *   digits - 要计算的小数位数
+ */
+void compute_e(mpf_t e, uint64_t digits) {
+    (void)digits;
+    /* 最小的N使余项小于工作精度的最后一位 */
+    uint64_t terms = bs_terms(&e_series, -(double)mpf_get_prec(e));
+    
+    bs_node_t root;
+    bs_node_init(&root);
+    bs_evaluate(&e_series, &root, 1, terms);  // Σ_{k>=1} 1/k!
+    
+    /* e = 1 + T/Q */
+    double r = mpf_set_ratio(e, root.t, root.q);
+    mpf_add_ui(e, e, 1);
+    radius_log2 = log2_sum(e_series.tail(&e_series, terms), ball_round(r, e));
+    
+    bs_node_clear(&root);
+}
+
+/* ===== 流式输出（spigot算法） ===== */
+
+/*
+ * Rabinowitz-Wagon spigot算法（Dik Winter的万进制写法）：
+ * 把π写成混合进制数 2 + 1/3*(2 + 2/5*(2 + 3/7*(2 + ...)))，
+ * 每个格子存一个“数字”。每一轮把所有格子乘以10^4并从右往左进位，
+ * 最左边溢出的部分就是接下来的4位十进制数字，同时格子数减少14个。
+ * 内存固定为约3.5个uint32/位，不需要大数运算，第一组数字在一轮扫描后就能输出。
+ *
+ * 一组数字可能等于10^4以上，需要向前一组进位，所以最后一组和其后连续的9999
+ * 要暂存，直到确定不会再进位才输出。
+ */
+#define SPIGOT_BASE 10000
+#define SPIGOT_GROUP_DIGITS 4
+
+/* 流式输出的状态：已输出的位数和暂存的组 */
+typedef struct {
+    uint64_t emitted;       // 已输出的数字个数（含整数部分3）
+    uint64_t limit;         // 要输出的数字总数（含整数部分）
+    long held;              // 暂存的一组（-1表示还没有）
+    uint64_t nines;         // 暂存组后面连续的9999个数
+    double last_flush;      // 上次刷新输出的时间
+} spigot_out_t;
+
+/* 输出一组4位数字，到达位数上限后不再输出 */
+void spigot_put_group(spigot_out_t *o, unsigned group) {
+    char buf[SPIGOT_GROUP_DIGITS];
+    for (int i = SPIGOT_GROUP_DIGITS - 1; i >= 0; i--) {
+        buf[i] = (char)('0' + group % 10);
+        group /= 10;
+    }
+    for (int i = 0; i < SPIGOT_GROUP_DIGITS && o->emitted < o->limit; i++) {
+        putchar(buf[i]);
+        if (o->emitted++ == 0) putchar('.');  // 整数部分3之后是小数点
+    }
+}
+
+/* 接收新算出的一组（可能 >= 10^4），处理进位后输出已经确定的组 */
+void spigot_push(spigot_out_t *o, unsigned value) {
+    if (value >= SPIGOT_BASE) {
+        /* 进位：暂存组加1，后面的9999全部变成0000 */
+        spigot_put_group(o, (unsigned)o->held + 1);
+        for (; o->nines > 0; o->nines--) spigot_put_group(o, 0);
+        o->held = value - SPIGOT_BASE;
+    } else if (value == SPIGOT_BASE - 1 && o->held >= 0) {
+        o->nines++;
+    } else {
+        if (o->held >= 0) spigot_put_group(o, (unsigned)o->held);
+        for (; o->nines > 0; o->nines--) spigot_put_group(o, SPIGOT_BASE - 1);
+        o->held = value;
+    }
+    
+    /* 首组立即刷新，之后每10毫秒刷新一次，兼顾交互和管道吞吐 */
+    double now = wall_time();
+    if (o->emitted <= SPIGOT_GROUP_DIGITS + 1 || now - o->last_flush > 0.01) {
+        fflush(stdout);
+        o->last_flush = now;
+    }
+}
+
+/*
+ * 用spigot算法把π的前digits位小数逐组输出到标准输出
+ * 返回值：成功返回1，内存不足返回0
+ */
+int stream_pi_digits(uint64_t digits) {
+    /* 多算两组，避免最后几组受截断误差影响 */
+    uint64_t groups = (digits + 1) / SPIGOT_GROUP_DIGITS + 3;
+    uint64_t cells = groups * 14;
+    uint32_t *f = malloc((cells + 1) * sizeof(uint32_t));
+    if (!f) {
+        fprintf(stderr, "错误: 内存不足\n");
+        return 0;
+    }
+    for (uint64_t i = 0; i <= cells; i++) f[i] = SPIGOT_BASE / 5;
+    
+    spigot_out_t out = { 0, digits + 1, -1, 0, wall_time() };
+    double start = out.last_flush;
+    uint64_t carry = 0;  // 上一轮留下的余数（< 10^4）
+    
+    for (uint64_t c = cells; c > 0 && out.emitted < out.limit && keep_running; c -= 14) {
+        uint64_t d = 0;
+        uint64_t g = c * 2;
+        for (uint64_t b = c; ; ) {
+            d += (uint64_t)f[b] * SPIGOT_BASE;
+            f[b] = (uint32_t)(d % --g);
+            d /= g--;
+            if (--b == 0) break;
+            d *= b;
+        }
+        spigot_push(&out, (unsigned)(carry + d / SPIGOT_BASE));
+        carry = d % SPIGOT_BASE;
+    }
+    
+    /* 输出最后暂存的组 */
+    if (out.held >= 0) spigot_put_group(&out, (unsigned)out.held);
+    for (; out.nines > 0; out.nines--) spigot_put_group(&out, SPIGOT_BASE - 1);
+    putchar('\n');
+    fflush(stdout);
+    
+    double elapsed = wall_time() - start;
+    if (!quiet) {
+        fprintf(stderr, "流式输出 %llu 位，耗时 %.3f 秒\n",
+                (unsigned long long)(out.emitted > 0 ? out.emitted - 1 : 0), elapsed);
+    }
+    free(f);
+    return 1;
+}
+
+/* ===== 十进制数字提取（Plouffe/Bellard算法） ===== */
+
+/*
+ * 利用 π + 3 = Σ k * 2^k * (k!)^2 / (2k)! = Σ k * k! / (1*3*5*...*(2k-1))
+ * 对每个奇素数的幂 a^vmax <= 2N，在模 a^vmax 下求级数乘以10^(n-1)后的小数部分，
+ * 再把所有素数的结果相加取小数部分，就得到第n位起的若干位数字。
+ * 这是Bellard对Plouffe方法的改进：约 3.3n 项乘以约 6.6n/ln(6.6n) 个素数，
+ * 每项几次模乘，时间O(n^2)，内存与位置无关。
+ * 各素数之间互相独立，按素数区间切成任务交给线程池。
+ */
+/* 模数大于2^32时a*b会溢出，要用128位乘法 */
+uint64_t mul_mod(uint64_t a, uint64_t b, uint64_t m) {
+    if (m <= UINT32_MAX) return a * b % m;
+    return (uint64_t)((unsigned __int128)a * b % m);
+}
+
+/*
+ * 数字提取内层循环用的模乘：用预先算好的 1/m 估计商，代替64位除法。
+ * 要求 m < 2^32、a*b < 2^64：估计的商最多差1，余数修正一次即可
+ */
+uint64_t mul_mod_recip(uint64_t a, uint64_t b, uint64_t m, double recip) {
+    uint64_t q = (uint64_t)((double)a * (double)b * recip);
+    int64_t r = (int64_t)(a * b - q * m);
+    if (r < 0) r += (int64_t)m;
+    else if (r >= (int64_t)m) r -= (int64_t)m;
+    return (uint64_t)r;
+}
+
+uint64_t pow_mod(uint64_t a, uint64_t b, uint64_t m) {
+    uint64_t r = 1 % m;
+    a %= m;
+    while (b > 0) {
+        if (b & 1) r = mul_mod(r, a, m);
+        a = mul_mod(a, a, m);
+        b >>= 1;
+    }
+    return r;
+}
+
+/* x 在模 m 下的逆（x与m互素） */
+uint64_t inv_mod(uint64_t x, uint64_t m) {
+    int64_t a = 0, c = 1;
+    int64_t u = (int64_t)x, v = (int64_t)m;
+    while (u != 0) {
+        int64_t q = v / u, t;
+        t = c; c = a - q * c; a = t;
+        t = u; u = v - q * u; v = t;
+    }
+    a %= (int64_t)m;
+    return (uint64_t)(a < 0 ? a + (int64_t)m : a);
+}
+
+int is_odd_prime(uint64_t n) {
+    if (n < 3 || (n & 1) == 0) return 0;
+    for (uint64_t i = 3; i * i <= n; i += 2) {
+        if (n % i == 0) return 0;
+    }
+    return 1;
+}
+
+#define EXTRACT_GOOD_DIGITS 7   // 提取的9位中可信的位数（最后两位可能受舍入影响）
+
+/* 一段素数区间的任务 */
+typedef struct {
+    uint64_t lo, hi;        // 处理 [lo, hi) 中的奇素数
+    uint64_t n, terms;      // 位置和级数项数N
+    long double sum;        // 本区间结果之和的小数部分
+} digit_task_t;
+
+/*
+ * 素数a对结果的贡献：(10^(n-1) * Σ ...) mod a^vmax / a^vmax
+ * 各项的分母不同，按Bellard的做法把和保持为分数 s/den：分母每乘一个因子，
+ * s也乘上它，整个循环只在最后求一次逆，每项只有几次模乘
+ */
+long double digit_prime_term(uint64_t a, uint64_t n, uint64_t terms) {
+    int vmax = (int)(log(2.0 * terms) / log((double)a));
+    uint64_t pw[64];  // pw[i] = a^i
+    pw[0] = 1;
+    for (int i = 1; i <= vmax; i++) pw[i] = pw[i - 1] * a;
+    uint64_t av = pw[vmax];
+    double recip = 1.0 / (double)av;  // 位置不超过DECIMAL_AT_MAX时 av <= 2N < 2^32，k也小于2^32
+    
+    uint64_t s = 0, num = 1, den = 1, kq = 1, kq2 = 1;
+    int v = 0;  // 当前项中a的指数
+    for (uint64_t k = 1; k <= terms; k++) {
+        /* 分子乘以k，去掉其中的a因子 */
+        uint64_t t = k;
+        if (kq >= a) {
+            do {
+                t /= a;
+                v--;
+            } while (t % a == 0);
+            kq = 0;
+        }
+        kq++;
+        num = mul_mod_recip(num, t, av, recip);
+        
+        /* 分母乘以2k-1，去掉其中的a因子；和的分母也跟着乘 */
+        t = 2 * k - 1;
+        if (kq2 >= a) {
+            if (kq2 == a) {
+                do {
+                    t /= a;
+                    v++;
+                } while (t % a == 0);
+            }
+            kq2 -= a;
+        }
+        den = mul_mod_recip(den, t, av, recip);
+        s = mul_mod_recip(s, t, av, recip);
+        kq2 += 2;
+        
+        /* 这一项是 k*num/(den*a^v)，在分母den之下加上 k*num*a^(vmax-v) */
+        if (v > 0) {
+            s += mul_mod_recip(mul_mod_recip(num, k, av, recip), pw[vmax - v], av, recip);
+            if (s >= av) s -= av;
+        }
+    }
+    
+    s = mul_mod(s, inv_mod(den, av), av);
+    s = mul_mod(s, pow_mod(10, n - 1, av), av);
+    return (long double)s / (long double)av;
+}
+
+void digit_task_run(void *arg) {
+    digit_task_t *t = arg;
+    long double sum = 0;
+    for (uint64_t a = t->lo | 1; a < t->hi; a += 2) {
+        if (!is_odd_prime(a)) continue;
+        sum += digit_prime_term(a, t->n, t->terms);
+        sum -= floorl(sum);
+    }
+    t->sum = sum;
+}
+
+/*
+ * 求π小数点后第pos位起的9位数字，写入out（以'\0'结尾）
+ * 最后一两位可能受舍入影响，校验时应只比较前几位
+ */
+void pi_digits_at(uint64_t pos, char out[10]) {
+    uint64_t terms = (uint64_t)((pos + 20) * log(10.0) / log(2.0));
+    uint64_t limit = 2 * terms + 1;  // 处理所有 3 <= a <= 2N 的素数
+    
+    /* 区间数取线程数的8倍，让动态领取均衡掉素数密度的差异 */
+    size_t count = (size_t)num_threads * 8;
+    if (count > limit / 16 + 1) count = limit / 16 + 1;
+    digit_task_t *dt = malloc(count * sizeof(digit_task_t));
+    task_t *tasks = malloc(count * sizeof(task_t));
+    if (!dt || !tasks) {
+        fprintf(stderr, "错误: 内存不足\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < count; i++) {
+        dt[i].lo = 3 + (limit - 3) * i / count;
+        dt[i].hi = 3 + (limit - 3) * (i + 1) / count;
+        dt[i].n = pos;
+        dt[i].terms = terms;
+        dt[i].sum = 0;
+        tasks[i].run = digit_task_run;
+        tasks[i].arg = &dt[i];
+        tasks[i].cost = (double)(dt[i].hi - dt[i].lo);
+    }
+    run_tasks(tasks, count);
+    
+    long double sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += dt[i].sum;
+        sum -= floorl(sum);
+    }
+    snprintf(out, 10, "%09llu", (unsigned long long)(sum * 1e9L));
+    free(dt);
+    free(tasks);
+}
+
+/* ===== 结果文件校验 ===== */
+
+/*
+ * 校验分两步：
+ * 1. 多线程按块计算FNV-1a摘要（同时检查非数字字符），与已知前缀摘要表对比；
+ * 2. 与内置的前1000位逐位对比。
+ * 不做数字提取抽查：提取是O(n^2)的，只够得着10^6位以内，而这一段摘要表已经覆盖了。
+ * 摘要 = 依次把每块（1MiB）的FNV-1a值再做一次FNV-1a折叠，块内与块间都可并行。
+ * 摘要不符时重新计算π到该区间末尾逐位对比，给出确切的第一个错误位置。
+ * 不超过 10^7 位的文件，摘要表没覆盖的尾部也重新计算对比；更大的文件只校验前面，其余报告为未校验。
+ */
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+#define VERIFY_CHUNK (1 << 20)        // 摘要分块大小（位）
+#define VERIFY_RECOMPUTE_MAX 10000000ULL  // 不超过这么多位的文件，摘要表没覆盖的尾部重新计算对比
+
+/* π小数点后前1000位 */
+const char pi_prefix[] =
+    "1415926535897932384626433832795028841971693993751058209749445923078164062862089986280348253421170679"
+    "8214808651328230664709384460955058223172535940812848111745028410270193852110555964462294895493038196"
+    "4428810975665933446128475648233786783165271201909145648566923460348610454326648213393607260249141273"
+    "7245870066063155881748815209209628292540917153643678925903600113305305488204665213841469519415116094"
+    "3305727036575959195309218611738193261179310511854807446237996274956735188575272489122793818301194912"
+    "9833673362440656643086021394946395224737190702179860943702770539217176293176752384674818467669405132"
+    "0005681271452635608277857713427577896091736371787214684409012249534301465495853710507922796892589235"
+    "4201995611212902196086403441815981362977477130996051870721134999999837297804995105973173281609631859"
+    "5024459455346908302642522308253344685035261931188171010003137838752886587533208381420617177669147303"
+    "5982534904287554687311595628638823537875937519577818577805321712268066130019278766111959092164201989";
+
+/* 已知的π前N位摘要（两种算法结果一致） */
+typedef struct {
+    uint64_t digits;
+    uint64_t digest;
+} known_digest_t;
+
+const known_digest_t known_digests[] = {
+    { 10ULL, 0xebad220ab7ebbe73ULL },
+    { 100ULL, 0xc48e66c1835566a9ULL },
+    { 1000ULL, 0xbc20f23531009a5eULL },
+    { 10000ULL, 0x91558023e4239264ULL },
+    { 100000ULL, 0xea005da8e1036f77ULL },
+    { 1000000ULL, 0x474bdc7942f2358aULL },
+    { 10000000ULL, 0x132f17eb041c918bULL },
+};
+
+uint64_t fnv1a(const char *p, size_t n) {
+    uint64_t h = FNV_OFFSET;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ (uint8_t)p[i]) * FNV_PRIME;
+    }
+    return h;
+}
+
+/* 以只读方式映射整个文件，失败返回NULL */
+const char *map_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // 映射建立后即可关闭
+    if (p == MAP_FAILED) return NULL;
+    madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+    *size = (size_t)st.st_size;
+    return p;
+}
+
+/*
+ * 在结果文件中定位小数部分：跳过开头的"整数部分."，去掉"\n\n"之后的尾部信息
+ * 尾部只在文件最后几百字节，从后往前找，避免扫描整个文件
+ */
+int find_digit_body(const char *data, size_t size, const char **body, uint64_t *len,
+                    const char **footer, size_t *footer_len) {
+    const char *dot = memchr(data, '.', size < 64 ? size : 64);
+    if (!dot) return -1;
+    const char *start = dot + 1;
+    const char *end = data + size;
+    *footer = end;
+    size_t tail = (size_t)(end - start) < 4096 ? (size_t)(end - start) : 4096;
+    for (const char *q = end - 2; q >= end - tail && q >= start; q--) {
+        if (q[0] == '\n' && q[1] == '\n') {
+            *footer = q + 2;
+            end = q;
+            break;
+        }
+    }
+    if (*footer == data + size && end > start && end[-1] == '\n') end--;
+    *body = start;
+    *len = (uint64_t)(end - start);
+    *footer_len = (size_t)(data + size - *footer);
+    return 0;
+}
+
+/* 一段连续块的摘要任务 */
+typedef struct {
+    const char *body;
+    uint64_t len;
+    uint64_t first, last;     // 负责的块 [first, last)
+    uint64_t *chunk_hash;     // 各块的FNV-1a值
+    uint64_t bad;             // 本段第一个非数字字符的位置（UINT64_MAX表示没有）
+} verify_task_t;
+
+void verify_task_run(void *arg) {
+    verify_task_t *t = arg;
+    t->bad = UINT64_MAX;
+    for (uint64_t c = t->first; c < t->last; c++) {
+        uint64_t lo = c * VERIFY_CHUNK;
+        uint64_t n = t->len - lo < VERIFY_CHUNK ? t->len - lo : VERIFY_CHUNK;
+        const char *p = t->body + lo;
+        t->chunk_hash[c] = fnv1a(p, n);
+        if (t->bad == UINT64_MAX) {
+            for (uint64_t i = 0; i < n; i++) {
+                if ((unsigned)(p[i] - '0') > 9) {
+                    t->bad = lo + i;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/* 前n位的摘要：整块用已算好的块值，最后不满一块的部分现算 */
+uint64_t prefix_digest(const char *body, const uint64_t *chunk_hash, uint64_t n) {
+    uint64_t h = FNV_OFFSET;
+    uint64_t full = n / VERIFY_CHUNK;
+    for (uint64_t c = 0; c < full; c++) {
+        h = (h ^ chunk_hash[c]) * FNV_PRIME;
+    }
+    if (n % VERIFY_CHUNK != 0) {
+        h = (h ^ fnv1a(body + full * VERIFY_CHUNK, n % VERIFY_CHUNK)) * FNV_PRIME;
+    }
+    return h;
+}
+
+/* 重新计算π的前hi位，返回body在 [lo, hi) 内第一个不同的位置（从0数），都相同或计算失败返回UINT64_MAX */
+uint64_t verify_locate(const char *body, uint64_t lo, uint64_t hi) {
+    int saved_constant = constant_id, saved_base = output_base, saved_quiet = quiet;
+    constant_id = CONST_PI;
+    output_base = 10;
+    quiet = 1;
+    char *ref = NULL;
+    uint64_t bad = UINT64_MAX;
+    if (calculate_constant_digits(hi, &ref) == hi) {
+        for (uint64_t i = lo; i < hi; i++) {
+            if (body[i] != ref[i]) {
+                bad = i;
+                break;
+            }
+        }
+    }
+    free(ref);
+    constant_id = saved_constant;
+    output_base = saved_base;
+    quiet = saved_quiet;
+    return bad;
+}
+
+int verify_result_file(const char *path) {
+    size_t size;
+    const char *data = map_file(path, &size);
+    if (!data) {
+        fprintf(stderr, "错误: 无法读取文件 %s\n", path);
+        return 1;
+    }
+    
+    const char *body, *footer;
+    uint64_t len;
+    size_t footer_len;
+    if (size < 2 || memcmp(data, "3.", 2) != 0 ||
+        find_digit_body(data, size, &body, &len, &footer, &footer_len) != 0 ||
+        memmem(footer, footer_len, "进制:", strlen("进制:")) != NULL) {
+        fprintf(stderr, "错误: %s 不是十进制圆周率结果文件\n", path);
+        munmap((void *)data, size);
+        return 1;
+    }
+    
+    printf("SuperPi - 校验 %s（%llu 位，%d线程）\n", path, (unsigned long long)len, num_threads);
+    double start = wall_time();
+    uint64_t first_bad = UINT64_MAX;      // 确切的第一个错误位置（从0数）
+    uint64_t range_lo = 0, range_hi = 0;  // 只知道错误所在区间时使用
+    int failed = 0;
+    
+    /* 尾部记录的位数应与实际位数一致 */
+    const char *tag = memmem(footer, footer_len, "位数: ", strlen("位数: "));
+    if (tag) {
+        unsigned long long recorded = strtoull(tag + strlen("位数: "), NULL, 10);
+        if (recorded != len) {
+            printf("  位数记录: 失败（尾部记录 %llu 位，实际 %llu 位）\n", recorded, (unsigned long long)len);
+            failed = 1;
+        }
+    }
+    
+    /* 1. 多线程分块计算摘要，同时找非数字字符 */
+    uint64_t chunks = (len + VERIFY_CHUNK - 1) / VERIFY_CHUNK;
+    size_t count = (size_t)num_threads * 4;
+    if (count > chunks) count = chunks;
+    if (count == 0) count = 1;
+    uint64_t *chunk_hash = malloc((chunks + 1) * sizeof(uint64_t));
+    verify_task_t *vt = malloc(count * sizeof(verify_task_t));
+    task_t *tasks = malloc(count * sizeof(task_t));
+    if (!chunk_hash || !vt || !tasks) {
+        fprintf(stderr, "错误: 内存不足\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < count; i++) {
+        vt[i].body = body;
+        vt[i].len = len;
+        vt[i].first = chunks * i / count;
+        vt[i].last = chunks * (i + 1) / count;
+        vt[i].chunk_hash = chunk_hash;
+        tasks[i].run = verify_task_run;
+        tasks[i].arg = &vt[i];
+        tasks[i].cost = (double)(vt[i].last - vt[i].first);
+    }
+    run_tasks(tasks, count);
+    for (size_t i = 0; i < count; i++) {
+        if (vt[i].bad < first_bad) first_bad = vt[i].bad;
+    }
+    if (first_bad != UINT64_MAX) {
+        printf("  字符检查: 失败（第 %llu 位不是数字）\n", (unsigned long long)first_bad + 1);
+        failed = 1;
+    }
+    
+    int checked = 0;
+    uint64_t prev = 0;
+    for (size_t i = 0; i < sizeof(known_digests) / sizeof(known_digests[0]); i++) {
+        const known_digest_t *k = &known_digests[i];
+        if (k->digits > len) break;
+        checked++;
+        if (prefix_digest(body, chunk_hash, k->digits) != k->digest) {
+            printf("  摘要对比: 前 %llu 位不一致\n", (unsigned long long)k->digits);
+            range_lo = prev;
+            range_hi = k->digits;
+            failed = 1;
+            break;
+        }
+        prev = k->digits;
+    }
+    if (checked > 0 && range_hi == 0) {
+        printf("  摘要对比: 通过（已知摘要覆盖前 %llu 位）\n", (unsigned long long)prev);
+    } else if (checked == 0) {
+        printf("  摘要对比: 跳过（位数少于摘要表）\n");
+    }
+    
+    /* 2. 与内置前缀逐位对比 */
+    uint64_t n = len < sizeof(pi_prefix) - 1 ? len : sizeof(pi_prefix) - 1;
+    uint64_t i;
+    for (i = 0; i < n && body[i] == pi_prefix[i]; i++) {
+    }
+    if (i < n) {
+        printf("  前缀对比: 失败（第 %llu 位）\n", (unsigned long long)i + 1);
+        if (i < first_bad) first_bad = i;
+        failed = 1;
+    } else {
+        printf("  前缀对比: 通过（前 %llu 位）\n", (unsigned long long)n);
+    }
+    
+    /* 摘要只能定位到区间，重新计算π到区间末尾找确切位置 */
+    if (range_hi > 0 && first_bad >= range_hi) {
+        printf("  重新计算前 %llu 位定位错误...\n", (unsigned long long)range_hi);
+        fflush(stdout);
+        uint64_t bad = verify_locate(body, range_lo, range_hi);
+        if (bad != UINT64_MAX) first_bad = bad;
+    }
+    
+    /* 摘要表没覆盖的尾部：文件不大时重新计算对比 */
+    uint64_t covered = prev > n ? prev : n;
+    if (!failed && covered < len && len <= VERIFY_RECOMPUTE_MAX) {
+        uint64_t bad = verify_locate(body, covered, len);
+        if (bad != UINT64_MAX) {
+            printf("  重新计算: 失败（第 %llu 位）\n", (unsigned long long)bad + 1);
+            first_bad = bad;
+            failed = 1;
+        } else {
+            printf("  重新计算: 第 %llu 到 %llu 位通过\n", (unsigned long long)covered + 1, (unsigned long long)len);
+            covered = len;
+        }
+    }
+    
+    /* 汇总：确切位置优先，否则给出摘要定位的区间；没有覆盖到的尾部如实报告 */
+    if (!failed && covered >= len) {
+        printf("校验通过，耗时 %.2f 秒\n", wall_time() - start);
+    } else if (!failed) {
+        printf("前 %llu 位校验通过，第 %llu 到 %llu 位未校验（超出内置摘要表和重新计算的范围），耗时 %.2f 秒\n",
+               (unsigned long long)covered, (unsigned long long)covered + 1, (unsigned long long)len,
+               wall_time() - start);
+    } else if (first_bad != UINT64_MAX && (range_hi == 0 || first_bad < range_hi)) {
+        printf("校验失败: 第一个错误位于小数点后第 %llu 位\n", (unsigned long long)first_bad + 1);
+    } else if (range_hi > 0) {
+        printf("校验失败: 第一个错误位于小数点后第 %llu 到 %llu 位之间\n",
+               (unsigned long long)range_lo + 1, (unsigned long long)range_hi);
+    } else {
+        printf("校验失败\n");
+    }
+    
+    free(chunk_hash);
+    free(vt);
+    free(tasks);
+    munmap((void *)data, size);
+    return failed ? 1 : 0;
+}
+
+/* ===== 结果文件比较 ===== */
+
+#define DIFF_CONTEXT 10               // 每处不同前后显示的字符数
+#define DIFF_MIN_CHUNK (16 << 20)     // 每个比较任务至少16MiB，太小时调度开销占主导
+
+/* 一段区间的比较任务 */
+typedef struct {
+    const char *a, *b;
+    uint64_t lo, hi;          // 比较 [lo, hi)
+    uint64_t *pos;            // 本段前diff_max处不同的位置
+    int found;                // 已记录的位置数
+    uint64_t count;           // 本段不同的总数
+} diff_task_t;
+
+void diff_record(diff_task_t *t, uint64_t i) {
+    t->count++;
+    if (t->found < diff_max) t->pos[t->found++] = i;
+}
+
+void diff_task_run(void *arg) {
+    diff_task_t *t = arg;
+    uint64_t i = t->lo;
+    t->found = 0;
+    t->count = 0;
+#ifdef __AVX2__
+    /* 每次比较32字节，相同的块只需一次比较和一次movemask */
+    for (; i + 32 <= t->hi; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(t->a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(t->b + i));
+        uint32_t ne = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        while (ne) {
+            diff_record(t, i + (uint64_t)__builtin_ctz(ne));
+            ne &= ne - 1;
+        }
+    }
+#endif
+    for (; i < t->hi; i++) {
+        if (t->a[i] != t->b[i]) diff_record(t, i);
+    }
+}
+
+/* 打印第i位附近的内容，不同的那一位用[]标出 */
+void diff_print_context(const char *label, const char *body, uint64_t len, uint64_t i) {
+    uint64_t lo = i > DIFF_CONTEXT ? i - DIFF_CONTEXT : 0;
+    uint64_t hi = i + DIFF_CONTEXT + 1 < len ? i + DIFF_CONTEXT + 1 : len;
+    printf("    %s: %s%.*s[%c]%.*s%s\n", label, lo > 0 ? "..." : "",
+           (int)(i - lo), body + lo, body[i], (int)(hi - i - 1), body + i + 1, hi < len ? "..." : "");
+}
+
+int diff_result_files(const char *path_a, const char *path_b) {
+    size_t size_a, size_b;
+    const char *data_a = map_file(path_a, &size_a);
+    const char *data_b = map_file(path_b, &size_b);
+    if (!data_a || !data_b) {
+        fprintf(stderr, "错误: 无法读取文件 %s\n", data_a ? path_b : path_a);
+        if (data_a) munmap((void *)data_a, size_a);
+        if (data_b) munmap((void *)data_b, size_b);
+        return 2;
+    }
+    
+    const char *a, *b, *footer;
+    uint64_t len_a, len_b;
+    size_t footer_len;
+    if (find_digit_body(data_a, size_a, &a, &len_a, &footer, &footer_len) != 0 ||
+        find_digit_body(data_b, size_b, &b, &len_b, &footer, &footer_len) != 0) {
+        fprintf(stderr, "错误: 不是SuperPi结果文件\n");
+        munmap((void *)data_a, size_a);
+        munmap((void *)data_b, size_b);
+        return 2;
+    }
+    
+    int differ = 0;
+    if (a - data_a != b - data_b || memcmp(data_a, data_b, (size_t)(a - data_a)) != 0) {
+        printf("整数部分不同: %.*s 与 %.*s\n", (int)(a - data_a - 1), data_a, (int)(b - data_b - 1), data_b);
+        differ = 1;
+    }
+    
+    /* 按区间切成任务并行比较，每个任务保留自己的前diff_max处 */
+    double start = wall_time();
+    uint64_t len = len_a < len_b ? len_a : len_b;
+    size_t count = (size_t)num_threads * 4;
+    if (count > len / DIFF_MIN_CHUNK) count = len / DIFF_MIN_CHUNK;
+    if (count == 0) count = 1;
+    diff_task_t *dt = malloc(count * sizeof(diff_task_t));
+    task_t *tasks = malloc(count * sizeof(task_t));
+    uint64_t *pos = malloc(count * (size_t)diff_max * sizeof(uint64_t));
+    if (!dt || !tasks || !pos) {
+        fprintf(stderr, "错误: 内存不足\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < count; i++) {
+        dt[i].a = a;
+        dt[i].b = b;
+        dt[i].lo = len * i / count;
+        dt[i].hi = len * (i + 1) / count;
+        dt[i].pos = pos + i * (size_t)diff_max;
+        tasks[i].run = diff_task_run;
+        tasks[i].arg = &dt[i];
+        tasks[i].cost = (double)(dt[i].hi - dt[i].lo);
+    }
+    run_tasks(tasks, count);
+    double elapsed = wall_time() - start;
+    
+    /* 任务按位置先后排列，依次取出即是全局的前diff_max处 */
+    uint64_t total = 0;
+    int shown = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += dt[i].count;
+        for (int j = 0; j < dt[i].found && shown < diff_max; j++, shown++) {
+            uint64_t p = dt[i].pos[j];
+            printf("  第 %llu 位不同:\n", (unsigned long long)p + 1);
+            diff_print_context("A", a, len_a, p);
+            diff_print_context("B", b, len_b, p);
+        }
+    }
+    if (total > (uint64_t)shown) {
+        printf("  ……另有 %llu 处不同未显示\n", (unsigned long long)(total - shown));
+    }
+    if (len_a != len_b) {
+        printf("位数不同: A有 %llu 位，B有 %llu 位（只比较了前 %llu 位）\n",
+               (unsigned long long)len_a, (unsigned long long)len_b, (unsigned long long)len);
+        differ = 1;
+    }
+    if (total > 0) differ = 1;
+    
+    printf("比较了 %llu 位，%llu 处不同，耗时 %.3f 秒（%.2f GB/s，%d线程）\n",
+           (unsigned long long)len, (unsigned long long)total, elapsed,
+           elapsed > 0 ? 2.0 * (double)len / elapsed / 1e9 : 0.0, num_threads);
+    
+    free(dt);
+    free(tasks);
+    free(pos);
+    munmap((void *)data_a, size_a);
+    munmap((void *)data_b, size_b);
+    return differ;
+}
+
+/* ===== 运行历史记录 ===== */
+
+/*
+ * 每次计算完成后向JSON Lines文件追加一行记录，只追加不改写。
+ * 文件位置：环境变量SUPERPI_HISTORY（设为空字符串则不记录），
+ * 否则为 $XDG_DATA_HOME/superpi/history.jsonl 或 ~/.local/share/superpi/history.jsonl。
+ * 摘要与 --verify-file 的定义相同，十进制π的10^k位结果可直接与已知摘要表对照。
+ */
+#define HISTORY_WINDOW 5      // 滚动中位数取前几次运行
+#define HISTORY_MIN_RUNS 3    // 至少有几次之前的运行才判断回退
+#define HISTORY_SHOW 10       // 每种配置显示最近几次
+
+/* 历史记录文件路径，不记录时返回NULL */
+const char *history_path(void) {
+    static char path[4096];
+    const char *env = getenv("SUPERPI_HISTORY");
+    if (env) return *env ? env : NULL;
+    const char *xdg = getenv("XDG_DATA_HOME");
+    const char *home = getenv("HOME");
+    if (xdg && *xdg) {
+        snprintf(path, sizeof(path), "%s/superpi/history.jsonl", xdg);
+    } else if (home && *home) {
+        snprintf(path, sizeof(path), "%s/.local/share/superpi/history.jsonl", home);
+    } else {
+        return NULL;
+    }
+    return path;
+}
+
+/* 逐级创建path所在的目录（已存在则忽略） */
+void make_parent_dirs(const char *path) {
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *q = dir + 1; *q; q++) {
+        if (*q == '/') {
+            *q = '\0';
+            mkdir(dir, 0755);
+            *q = '/';
+        }
+    }
+}
+
+/* 从 /proc/cpuinfo 读取CPU型号 */
+void cpu_model(char *buf, size_t size) {
+    snprintf(buf, size, "unknown");
+    FILE *fp = fopen("/proc/cpuinfo", "r");
+    if (!fp) return;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "model name", 10) == 0) {
+            char *v = strchr(line, ':');
+            if (v) {
+                v += strspn(v + 1, " \t") + 1;
+                v[strcspn(v, "\n")] = '\0';
+                snprintf(buf, size, "%s", v);
+            }
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+/* 写入带引号和转义的JSON字符串 */
+void json_put_str(FILE *fp, const char *str) {
+    fputc('"', fp);
+    for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', fp);
+            fputc(*c, fp);
+        } else if (*c < 0x20) {
+            fprintf(fp, "\\u%04x", *c);
+        } else {
+            fputc(*c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/* 在一行记录中找到 "key": 之后的值的位置（允许冒号前后有空格），找不到返回NULL */
+const char *json_find(const char *line, const char *key) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+    for (const char *p = strstr(line, pattern); p; p = strstr(p + 1, pattern)) {
+        const char *v = p + strlen(pattern);
+        v += strspn(v, " \t");
+        if (*v == ':') return v + 1 + strspn(v + 1, " \t");
+    }
+    return NULL;
+}
+
+/* 读取字符串字段（只处理本程序写出的简单转义） */
+int json_get_str(const char *line, const char *key, char *buf, size_t size) {
+    const char *p = json_find(line, key);
+    if (!p || *p != '"') return -1;
+    size_t n = 0;
+    for (p++; *p && *p != '"' && n + 1 < size; p++) {
+        if (*p == '\\' && p[1]) p++;
+        buf[n++] = *p;
+    }
+    buf[n] = '\0';
+    return 0;
+}
+
+double json_get_num(const char *line, const char *key) {
+    const char *p = json_find(line, key);
+    return p ? strtod(p, NULL) : 0;
+}
+
+/* 与 --verify-file 相同的分块FNV-1a摘要 */
+uint64_t digits_digest(const char *p, uint64_t n) {
+    uint64_t h = FNV_OFFSET;
+    for (uint64_t lo = 0; lo < n; lo += VERIFY_CHUNK) {
+        uint64_t len = n - lo < VERIFY_CHUNK ? n - lo : VERIFY_CHUNK;
+        h = (h ^ fnv1a(p + lo, len)) * FNV_PRIME;
+    }
+    return h;
+}
+
+void history_append(uint64_t digits, const char *result, double seconds) {
+    const char *path = history_path();
+    if (!path) return;
+    make_parent_dirs(path);
+    
+    char host[256] = "unknown", cpu[256];
+    gethostname(host, sizeof(host) - 1);
+    cpu_model(cpu, sizeof(cpu));
+    
+    /* 整行先写入内存，再一次写入文件，O_APPEND保证多个进程同时追加时行不交错 */
+    char *line = NULL;
+    size_t line_len = 0;
+    FILE *mem = open_memstream(&line, &line_len);
+    if (!mem) return;
+    fprintf(mem, "{\"time\":%lld,\"host\":", (long long)time(NULL));
+    json_put_str(mem, host);
+    fprintf(mem, ",\"cpu\":");
+    json_put_str(mem, cpu);
+#ifdef GIT_VERSION
+    fprintf(mem, ",\"version\":\"%s\"", GIT_VERSION);
+#endif
+    fprintf(mem, ",\"constant\":\"%s\",\"digits\":%llu,\"base\":%d,\"algorithm\":",
+            constants[constant_id].option, (unsigned long long)digits, output_base);
+    json_put_str(mem, algorithm_name());
+    fprintf(mem, ",\"threads\":%d,\"seconds\":%.6f,\"compute\":%.6f,\"convert\":%.6f,"
+            "\"hash\":\"%016llx\"}\n", num_threads, seconds, phase_compute, phase_convert,
+            (unsigned long long)digits_digest(result, digits));
+    fclose(mem);
+    
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0 || write(fd, line, line_len) != (ssize_t)line_len) {
+        fprintf(stderr, "警告: 无法写入历史记录 %s\n", path);
+    }
+    if (fd >= 0) close(fd);
+    free(line);
+}
+
+/* 一条历史记录 */
+typedef struct {
+    long long time;
+    char config[256];         // 常数、位数、进制、算法、线程数
+    char version[64];
+    char hash[24];
+    double seconds;
+    size_t order;             // 在文件中的行号，用于稳定排序
+} history_rec_t;
+
+int history_rec_cmp(const void *x, const void *y) {
+    const history_rec_t *a = x, *b = y;
+    int c = strcmp(a->config, b->config);
+    if (c != 0) return c;
+    return a->order < b->order ? -1 : (a->order > b->order);
+}
+
+int double_cmp(const void *x, const void *y) {
+    double a = *(const double *)x, b = *(const double *)y;
+    return a < b ? -1 : (a > b);
+}
+
+int show_history(void) {
+    const char *path = history_path();
+    FILE *fp = path ? fopen(path, "r") : NULL;
+    if (!fp) {
+        fprintf(stderr, "错误: 没有历史记录%s%s\n", path ? " " : "", path ? path : "");
+        return 1;
+    }
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    
+    /* 读入本机的记录 */
+    history_rec_t *recs = NULL;
+    size_t count = 0, capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, fp) > 0) {
+        char rec_host[256], constant[32], algorithm[128];
+        if (json_get_str(line, "host", rec_host, sizeof(rec_host)) != 0 || strcmp(rec_host, host) != 0) continue;
+        if (json_get_str(line, "constant", constant, sizeof(constant)) != 0) continue;
+        if (json_get_str(line, "algorithm", algorithm, sizeof(algorithm)) != 0) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            recs = realloc(recs, capacity * sizeof(history_rec_t));
+            if (!recs) {
+                fprintf(stderr, "错误: 内存不足\n");
+                exit(1);
+            }
+        }
+        history_rec_t *r = &recs[count];
+        char base[16] = "";
+        int rec_base = (int)json_get_num(line, "base");
+        if (rec_base != 10) snprintf(base, sizeof(base), " %d进制", rec_base);
+        snprintf(r->config, sizeof(r->config), "%s %llu位%s %s %d线程", constant,
+                 (unsigned long long)json_get_num(line, "digits"), base, algorithm,
+                 (int)json_get_num(line, "threads"));
+        if (json_get_str(line, "version", r->version, sizeof(r->version)) != 0) snprintf(r->version, sizeof(r->version), "-");
+        if (json_get_str(line, "hash", r->hash, sizeof(r->hash)) != 0) r->hash[0] = '\0';
+        r->time = (long long)json_get_num(line, "time");
+        r->seconds = json_get_num(line, "seconds");
+        r->order = count++;
+    }
+    free(line);
+    fclose(fp);
+    
+    printf("SuperPi - 历史记录 %s（主机 %s，%zu 条）\n", path, host, count);
+    qsort(recs, count, sizeof(history_rec_t), history_rec_cmp);
+    
+    /* 逐个配置：和之前几次的中位数比较，结果摘要和第一次比较 */
+    int latest_regressed = 0;
+    for (size_t g = 0; g < count;) {
+        size_t end = g;
+        while (end < count && strcmp(recs[end].config, recs[g].config) == 0) end++;
+        printf("\n%s\n", recs[g].config);
+        for (size_t i = end - g > HISTORY_SHOW ? end - HISTORY_SHOW : g; i < end; i++) {
+            history_rec_t *r = &recs[i];
+            char date[32];
+            time_t t = (time_t)r->time;
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&t));
+            printf("  %s  %-10s %10.3f 秒", date, r->version, r->seconds);
+            
+            size_t prev = i - g < HISTORY_WINDOW ? i - g : HISTORY_WINDOW;
+            if (prev >= HISTORY_MIN_RUNS) {
+                double window[HISTORY_WINDOW];
+                for (size_t k = 0; k < prev; k++) window[k] = recs[i - prev + k].seconds;
+                qsort(window, prev, sizeof(double), double_cmp);
+                double median = prev % 2 ? window[prev / 2] : (window[prev / 2 - 1] + window[prev / 2]) / 2;
+                double change = (r->seconds / median - 1) * 100;
+                printf("  %+6.1f%%", change);
+                if (change > regress_threshold) {
+                    printf("  性能回退（中位数 %.3f 秒）", median);
+                    if (i == end - 1) latest_regressed = 1;
+                }
+            }
+            if (r->hash[0] && recs[g].hash[0] && strcmp(r->hash, recs[g].hash) != 0) {
+                printf("  结果摘要与之前不同！");
+            }
+            printf("\n");
+        }
+        g = end;
+    }
+    free(recs);
+    return latest_regressed;
+}
+
+/* ===== A/B性能对比 ===== */
+
+/*
+ * 两个程序在同样的位数下交替运行（每轮按ABBA顺序，抵消升频、温度等缓慢漂移），
+ * 子进程固定在同一组CPU上，在临时目录中运行，不写历史记录。
+ * 子进程输出的"阶段耗时"行给出各阶段时间，总计为子进程的墙钟时间。
+ * 每个位数、每个阶段用Welch t检验判断差异是否显著。
+ */
+#define AB_PHASES 3
+#define AB_SIGNIFICANCE 0.05          // p值小于此值认为差异显著
+
+const uint64_t ab_sizes[] = { 10000, 100000, 1000000 };  // 未给出位数时对比的位数
+const char *ab_phase_names[AB_PHASES] = { "计算", "转换", "总计" };
+
+/*
+ * 运行一次子进程：exe [args...] digits，结果写入times（计算、转换、总计）
+ * 旧版本没有"阶段耗时"行时，前两项为NAN
+ */
+int ab_run_child(const char *exe, char **args, int nargs, uint64_t digits, const char *dir,
+                 const cpu_set_t *cpus, double times[AB_PHASES]) {
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+    char digits_arg[32];
+    snprintf(digits_arg, sizeof(digits_arg), "%llu", (unsigned long long)digits);
+    
+    double start = wall_time();
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        char **child_argv = malloc((size_t)(nargs + 3) * sizeof(char *));
+        if (!child_argv) _exit(127);
+        child_argv[0] = (char *)exe;
+        for (int i = 0; i < nargs; i++) child_argv[i + 1] = args[i];
+        child_argv[nargs + 1] = digits_arg;
+        child_argv[nargs + 2] = NULL;
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        sched_setaffinity(0, sizeof(cpu_set_t), cpus);
+        setenv("SUPERPI_HISTORY", "", 1);
+        if (chdir(dir) != 0) _exit(127);
+        execv(exe, child_argv);
+        _exit(127);
+    }
+    close(fds[1]);
+    
+    /* 读完子进程的输出，找出阶段耗时 */
+    char buf[8192];
+    size_t used = 0;
+    ssize_t n;
+    while ((n = read(fds[0], buf + used, sizeof(buf) - 1 - used)) > 0) {
+        used += (size_t)n;
+        if (used == sizeof(buf) - 1) {  // 只需要最后几行
+            memmove(buf, buf + sizeof(buf) / 2, used - sizeof(buf) / 2);
+            used -= sizeof(buf) / 2;
+        }
+    }
+    buf[used] = '\0';
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    times[2] = wall_time() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    
+    times[0] = times[1] = NAN;
+    const char *line = strstr(buf, "阶段耗时: 计算 ");
+    if (line) sscanf(line, "阶段耗时: 计算 %lf 秒，转换 %lf", &times[0], &times[1]);
+    return 0;
+}
+
+/* 正则化不完全Beta函数的连分式（Lentz方法） */
+double beta_cf(double a, double b, double x) {
+    double c = 1, d = 1 - (a + b) * x / (a + 1);
+    if (fabs(d) < 1e-300) d = 1e-300;
+    d = 1 / d;
+    double h = d;
+    for (int m = 1; m <= 200; m++) {
+        for (int odd = 0; odd < 2; odd++) {
+            double num = odd ? -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1))
+                             : m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+            d = 1 + num * d;
+            if (fabs(d) < 1e-300) d = 1e-300;
+            c = 1 + num / c;
+            if (fabs(c) < 1e-300) c = 1e-300;
+            d = 1 / d;
+            h *= d * c;
+            if (odd && fabs(d * c - 1) < 1e-12) return h;
+        }
+    }
+    return h;
+}
+
+double incomplete_beta(double a, double b, double x) {
+    if (x <= 0) return 0;
+    if (x >= 1) return 1;
+    double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+    if (x < (a + 1) / (a + b + 2)) return front * beta_cf(a, b, x) / a;
+    return 1 - front * beta_cf(b, a, 1 - x) / b;
+}
+
+/* Welch t检验的双侧p值 */
+double welch_p_value(const double *x, int nx, const double *y, int ny) {
+    double mx = 0, my = 0, vx = 0, vy = 0;
+    for (int i = 0; i < nx; i++) mx += x[i] / nx;
+    for (int i = 0; i < ny; i++) my += y[i] / ny;
+    for (int i = 0; i < nx; i++) vx += (x[i] - mx) * (x[i] - mx) / (nx - 1);
+    for (int i = 0; i < ny; i++) vy += (y[i] - my) * (y[i] - my) / (ny - 1);
+    double se2 = vx / nx + vy / ny;
+    if (se2 <= 0) return mx == my ? 1.0 : 0.0;
+    double t = (mx - my) / sqrt(se2);
+    double df = se2 * se2 / ((vx / nx) * (vx / nx) / (nx - 1) + (vy / ny) * (vy / ny) / (ny - 1));
+    return incomplete_beta(df / 2, 0.5, df / (df + t * t));
+}
+
+int ab_compare(const char *other, char **args, int nargs, uint64_t digits) {
+    char *exe_a = realpath("/proc/self/exe", NULL);
+    char *exe_b = realpath(other, NULL);
+    if (!exe_a || !exe_b || access(exe_b, X_OK) != 0) {
+        fprintf(stderr, "错误: 无法运行 %s\n", other);
+        free(exe_a);
+        free(exe_b);
+        return 1;
+    }
+    /* samples[(程序 * AB_PHASES + 阶段) * ab_runs + 第几次] */
+    double *samples = malloc((size_t)ab_runs * 2 * AB_PHASES * sizeof(double));
+    if (!samples) {
+        fprintf(stderr, "错误: 内存不足\n");
+        free(exe_a);
+        free(exe_b);
+        return 1;
+    }
+    char dir[] = "/tmp/superpi-ab-XXXXXX";
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "错误: 无法创建临时目录\n");
+        free(samples);
+        free(exe_a);
+        free(exe_b);
+        return 1;
+    }
+    
+    /* 两边都固定在当前可用CPU中的前num_threads个上 */
+    cpu_set_t allowed, cpus;
+    CPU_ZERO(&cpus);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int c = 0, taken = 0; c < CPU_SETSIZE && taken < num_threads; c++) {
+            if (CPU_ISSET(c, &allowed)) {
+                CPU_SET(c, &cpus);
+                taken++;
+            }
+        }
+    } else {
+        for (int c = 0; c < num_threads && c < CPU_SETSIZE; c++) CPU_SET(c, &cpus);
+    }
+    
+    printf("SuperPi - A/B性能对比（每个位数各运行 %d 次，ABBA交替，固定在 %d 个CPU上）\n",
+           ab_runs, CPU_COUNT(&cpus));
+    printf("  A（本程序）: %s\n", exe_a);
+    printf("  B（对比）  : %s\n\n", exe_b);
+    printf("      位数  阶段    A平均(秒)    B平均(秒)   加速比      p值\n");
+    
+    const uint64_t *sizes = digits ? &digits : ab_sizes;
+    int size_count = digits ? 1 : (int)(sizeof(ab_sizes) / sizeof(ab_sizes[0]));
+    int ret = 0;
+    for (int si = 0; si < size_count && keep_running; si++) {
+        for (int r = 0; r < ab_runs && ret == 0; r++) {
+            for (int k = 0; k < 2; k++) {
+                int which = (r % 2 == 0) ? k : 1 - k;  // 偶数轮AB，奇数轮BA
+                double times[AB_PHASES];
+                if (ab_run_child(which ? exe_b : exe_a, args, nargs, sizes[si], dir, &cpus, times) != 0) {
+                    fprintf(stderr, "错误: %s 运行失败\n", which ? exe_b : exe_a);
+                    ret = 1;
+                    break;
+                }
+                for (int ph = 0; ph < AB_PHASES; ph++) {
+                    samples[(which * AB_PHASES + ph) * ab_runs + r] = times[ph];
+                }
+            }
+        }
+        if (ret != 0) break;
+        
+        for (int ph = 0; ph < AB_PHASES; ph++) {
+            const double *a = &samples[ph * ab_runs];
+            const double *b = &samples[(AB_PHASES + ph) * ab_runs];
+            if (isnan(a[0]) || isnan(b[0])) continue;  // 旧版本没有分阶段计时
+            double ma = 0, mb = 0;
+            for (int r = 0; r < ab_runs; r++) {
+                ma += a[r] / ab_runs;
+                mb += b[r] / ab_runs;
+            }
+            double p = welch_p_value(a, ab_runs, b, ab_runs);
+            printf("%10llu  %s %12.4f %12.4f %7.3fx %8.4f%s\n", (unsigned long long)sizes[si],
+                   ab_phase_names[ph], ma, mb, ma > 0 ? mb / ma : 0, p,
+                   p < AB_SIGNIFICANCE ? (mb > ma ? "  A更快" : "  B更快") : "  无显著差异");
+        }
+    }
+    printf("\n加速比 = B耗时 / A耗时，大于1表示本程序更快\n");
+    
+    /* 清理子进程在临时目录中留下的结果文件 */
+    DIR *d = opendir(dir);
+    if (d) {
+        struct dirent *e;
+        while ((e = readdir(d)) != NULL) {
+            if (e->d_name[0] == '.') continue;
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+            unlink(path);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+    free(samples);
+    free(exe_a);
+    free(exe_b);
+    return ret;
+}
+
+/* ===== 基准测试套件 ===== */
+
+/*
+ * 位数取1000起的各个数量级，线程数取1、2、4……直到num_threads（不是2的幂时也加上它）。
+ * 强扩展：同样位数，线程越多越快，效率 = T1 / (p * Tp)。
+ * 弱扩展：每线程的工作量不变，位数按 n0*p 增长，按 n*log²n 的工作量换算理想时间。
+ * 复杂度拟合：每种线程数单独拟合 T = c * n*log²n，偏离超过25%的点标出。
+ */
+#define BENCH_MAX_THREAD_COUNTS 12    // 1、2、4……最多这么多种线程数
+#define BENCH_MAX_DECADES 10
+#define BENCH_REPEAT_BELOW 1.0        // 单次短于1秒时重复测，取最小值
+#define BENCH_REPEATS 3
+#define BENCH_FIT_TOLERANCE 0.25
+
+/* n*log²n 工作量模型 */
+double bench_work(uint64_t n) {
+    double l = log2((double)n);
+    return (double)n * l * l;
+}
+
+/* 用threads个线程计算digits位，返回耗时（短任务取多次的最小值） */
+double bench_run(uint64_t digits, int threads) {
+    num_threads = threads;
+    double best = 0;
+    for (int r = 0; r < BENCH_REPEATS && keep_running; r++) {
+        char *result = NULL;
+        double start = wall_time();
+        uint64_t done = calculate_constant_digits(digits, &result);
+        double elapsed = wall_time() - start;
+        free(result);
+        if (done == 0) return -1;
+        if (r == 0 || elapsed < best) best = elapsed;
+        if (best >= BENCH_REPEAT_BELOW) break;
+    }
+    return best;
+}
+
+int bench_suite(uint64_t max_digits) {
+    if (max_digits > MAX_DIGITS) {
+        fprintf(stderr, "错误: --bench-suite 最多%llu位\n", (unsigned long long)MAX_DIGITS);
+        return 1;
+    }
+    int max_threads = num_threads;
+    int threads[BENCH_MAX_THREAD_COUNTS];
+    int tc = 0;
+    for (int p = 1; p <= max_threads && tc < BENCH_MAX_THREAD_COUNTS; p *= 2) threads[tc++] = p;
+    if (threads[tc - 1] != max_threads && tc < BENCH_MAX_THREAD_COUNTS) threads[tc++] = max_threads;
+    uint64_t decades[BENCH_MAX_DECADES];
+    int dc = 0;
+    for (uint64_t n = 1000; n <= max_digits && dc < BENCH_MAX_DECADES; n *= 10) decades[dc++] = n;
+    if (dc == 0) {
+        fprintf(stderr, "错误: --bench-suite 至少需要1000位\n");
+        return 1;
+    }
+    
+    printf("SuperPi - 基准测试套件（%s，%s算法，最多 %llu 位，线程数:", constants[constant_id].name,
+           algorithm_name(), (unsigned long long)decades[dc - 1]);
+    for (int j = 0; j < tc; j++) printf(" %d", threads[j]);
+    printf("）\n");
+    quiet = 1;
+    
+    /* 强扩展 */
+    double strong[BENCH_MAX_DECADES][BENCH_MAX_THREAD_COUNTS];
+    printf("\n强扩展（位数不变）\n");
+    printf("      位数  线程     耗时(秒)   加速比    效率\n");
+    for (int i = 0; i < dc && keep_running; i++) {
+        for (int j = 0; j < tc && keep_running; j++) {
+            strong[i][j] = bench_run(decades[i], threads[j]);
+            if (strong[i][j] < 0) {
+                fprintf(stderr, "错误: %llu 位计算失败\n", (unsigned long long)decades[i]);
+                num_threads = max_threads;
+                quiet = 0;
+                return 1;
+            }
+            double speedup = strong[i][0] / strong[i][j];
+            printf("%10llu  %4d %12.4f %8.2fx %6.1f%%\n", (unsigned long long)decades[i], threads[j],
+                   strong[i][j], speedup, 100.0 * speedup / threads[j]);
+            fflush(stdout);
+        }
+    }
+    
+    /* 弱扩展：取最多线程时总位数不超过最大位数的最大数量级为基准 */
+    if (tc > 1 && keep_running) {
+        int bi = 0;
+        for (int i = 0; i < dc; i++) {
+            if (decades[i] * (uint64_t)max_threads <= decades[dc - 1]) bi = i;
+        }
+        uint64_t base = decades[bi];
+        printf("\n弱扩展（每线程 %llu 位）\n", (unsigned long long)base);
+        printf("      位数  线程     耗时(秒)  理想(秒)    效率\n");
+        for (int j = 0; j < tc && keep_running; j++) {
+            uint64_t n = base * (uint64_t)threads[j];
+            double t = j == 0 ? strong[bi][0] : bench_run(n, threads[j]);
+            if (t < 0) {
+                fprintf(stderr, "错误: %llu 位计算失败\n", (unsigned long long)n);
+                num_threads = max_threads;
+                quiet = 0;
+                return 1;
+            }
+            double ideal = strong[bi][0] * bench_work(n) / bench_work(base) / threads[j];
+            printf("%10llu  %4d %12.4f %10.4f %6.1f%%\n", (unsigned long long)n, threads[j], t, ideal,
+                   100.0 * ideal / t);
+            fflush(stdout);
+        }
+    }
+    num_threads = max_threads;
+    quiet = 0;
+    if (!keep_running) return 1;
+    
+    /* 复杂度拟合：对数空间最小二乘，c为 T/(n log²n) 的几何平均 */
+    printf("\n复杂度拟合 T = c * n*log²n\n");
+    int flagged = 0;
+    for (int j = 0; j < tc; j++) {
+        double sum = 0;
+        for (int i = 0; i < dc; i++) sum += log(strong[i][j] / bench_work(decades[i]));
+        double c = exp(sum / dc);
+        printf("  %d线程: c = %.3e 秒\n", threads[j], c);
+        for (int i = 0; i < dc; i++) {
+            double dev = strong[i][j] / (c * bench_work(decades[i])) - 1;
+            if (fabs(dev) > BENCH_FIT_TOLERANCE) {
+                printf("    %llu 位: 实测 %.4f 秒，模型 %.4f 秒，偏离 %+.0f%%\n",
+                       (unsigned long long)decades[i], strong[i][j], c * bench_work(decades[i]), 100 * dev);
+                flagged++;
+            }
+        }
+    }
+    if (flagged == 0) printf("  所有测点都在模型的±%.0f%%以内\n", 100 * BENCH_FIT_TOLERANCE);
+    return 0;
+}
+
+/* ===== CPU拓扑与线程放置（--placement） ===== */
+
+/*
+ * 拓扑来自/sys/devices/system/cpu/cpuN/topology：core_cpus_list（旧内核叫thread_siblings_list）
+ * 列出同一物理核心上的逻辑CPU，取其中编号最小的作为核心的标识。混合架构（大小核）的
+ * /sys/devices/cpu_core/cpus和cpu_atom/cpus分别列出性能核和能效核上的逻辑CPU。
+ * 计算主要受乘法吞吐量限制，SMT兄弟共用执行单元，多开线程不一定更快；能效核明显慢，
+ * 最后一个大任务落在能效核上会拖慢整体。哪种放置最快因机型而异，用--placement-bench实测。
+ */
+#define CORE_TYPE_UNKNOWN 0
+#define CORE_TYPE_P       1   // 性能核
+#define CORE_TYPE_E       2   // 能效核
+
+typedef struct {
+    int cpu;
+    int core;                 // 所在物理核心上编号最小的逻辑CPU
+    int sibling;              // 是本核心的第几个逻辑CPU（0为第一个）
+    int type;                 // CORE_TYPE_*
+} cpu_topo_t;
+
+cpu_set_t original_affinity;  // 第一次固定线程之前允许使用的CPU
+int original_affinity_saved = 0;
+
+/* 解析"0-3,8,10-11"格式的CPU列表，返回CPU个数，格式错误返回-1 */
+int parse_cpu_list(const char *s, cpu_set_t *set) {
+    CPU_ZERO(set);
+    int n = 0;
+    while (*s && *s != '\n') {
+        char *end;
+        long a = strtol(s, &end, 10), b = a;
+        if (end == s) return -1;
+        if (*end == '-') {
+            s = end + 1;
+            b = strtol(s, &end, 10);
+            if (end == s) return -1;
+        }
+        for (long c = a; c <= b && c < CPU_SETSIZE; c++) {
+            if (c >= 0) CPU_SET(c, set), n++;
+        }
+        s = end;
+        if (*s == ',') {
+            s++;
+        } else if (*s && *s != '\n') {
+            return -1;
+        }
+    }
+    return n;
+}
+
+int read_cpu_list(const char *path, cpu_set_t *set) {
+    char buf[4096];
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    int ok = fgets(buf, sizeof(buf), fp) != NULL;
+    fclose(fp);
+    return ok ? parse_cpu_list(buf, set) : -1;
+}
+
+/* 把CPU编号写成"0-3,8"的形式，太长时截断 */
+void format_cpu_list(const int *cpus, int n, char *buf, size_t size) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < n; i++) CPU_SET(cpus[i], &set);
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, &set)) continue;
+        int e = c;
+        while (e + 1 < CPU_SETSIZE && CPU_ISSET(e + 1, &set)) e++;
+        char part[32];
+        snprintf(part, sizeof(part), e > c ? "%s%d-%d" : "%s%d", len ? "," : "", c, e);
+        if (len + strlen(part) + 4 >= size) {
+            snprintf(buf + len, size - len, ",...");
+            return;
+        }
+        len += (size_t)snprintf(buf + len, size - len, "%s", part);
+        c = e;
+    }
+}
+
+/* 固定线程之后sched_getaffinity只剩一个CPU，拓扑总是按最初允许的CPU来读 */
+void save_original_affinity(void) {
+    if (original_affinity_saved) return;
+    if (sched_getaffinity(0, sizeof(original_affinity), &original_affinity) != 0) {
+        CPU_ZERO(&original_affinity);
+        for (int c = 0; c < num_threads && c < CPU_SETSIZE; c++) CPU_SET(c, &original_affinity);
+    }
+    original_affinity_saved = 1;
+}
+
+/* 读出允许使用的各逻辑CPU的拓扑，返回个数；hybrid置为是否有大小核信息 */
+int topology_read(cpu_topo_t *t, int max, int *hybrid) {
+    cpu_set_t pcores, ecores;
+    save_original_affinity();
+    *hybrid = read_cpu_list("/sys/devices/cpu_core/cpus", &pcores) > 0 &&
+              read_cpu_list("/sys/devices/cpu_atom/cpus", &ecores) > 0;
+    int n = 0;
+    for (int c = 0; c < CPU_SETSIZE && n < max; c++) {
+        if (!CPU_ISSET(c, &original_affinity)) continue;
+        char path[128];
+        cpu_set_t siblings;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_cpus_list", c);
+        if (read_cpu_list(path, &siblings) <= 0) {
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", c);
+            if (read_cpu_list(path, &siblings) <= 0) {
+                CPU_ZERO(&siblings);
+                CPU_SET(c, &siblings);
+            }
+        }
+        t[n].cpu = c;
+        t[n].core = c;
+        t[n].sibling = 0;
+        for (int d = 0; d < c; d++) {
+            if (!CPU_ISSET(d, &siblings)) continue;
+            if (t[n].sibling++ == 0) t[n].core = d;
+        }
+        t[n].type = !*hybrid ? CORE_TYPE_UNKNOWN
+                  : CPU_ISSET(c, &pcores) ? CORE_TYPE_P : CPU_ISSET(c, &ecores) ? CORE_TYPE_E : CORE_TYPE_UNKNOWN;
+        n++;
+    }
+    return n;
+}
+
+/*
+ * 末级缓存域：每个CPU的cache/indexN中level为3的那一项的shared_cpu_list（通常是index3），
+ * 列表中编号最小的CPU作为域的标识。芯粒（CCX）架构上L3按域分开，
+ * 一个域的线程去算另一个域刚写过的数据，要从别的芯粒的L3甚至内存里搬过来。
+ */
+void llc_init(void) {
+    int key[LLC_MAX_DOMAINS];
+    for (int c = 0; c < CPU_SETSIZE; c++) llc_domain_of[c] = -1;
+    save_original_affinity();
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, &original_affinity)) continue;
+        cpu_set_t shared;
+        int found = 0;
+        for (int idx = 0; idx < 16 && !found; idx++) {
+            char path[128];
+            long level;
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", c, idx);
+            if (read_long_file(path, &level) != 0) break;
+            if (level != 3) continue;
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", c, idx);
+            found = read_cpu_list(path, &shared) > 0;
+        }
+        if (!found) continue;
+        int first = c;
+        for (int d = 0; d < c; d++) {
+            if (CPU_ISSET(d, &shared)) {
+                first = d;
+                break;
+            }
+        }
+        int i = 0;
+        while (i < llc_domain_count && key[i] != first) i++;
+        if (i == llc_domain_count) {
+            if (llc_domain_count == LLC_MAX_DOMAINS) continue;
+            key[llc_domain_count++] = first;
+        }
+        llc_domain_of[c] = i;
+    }
+    llc_build_order();
+}
+
+/*
+ * 不固定CPU时（--placement=none）线程也要有确定的域，否则取哪个队列只能看
+ * 当时被调度到哪个CPU上。允许使用的CPU按域轮流排开（各域第1个、各域第2个……），
+ * id号线程归 llc_order[id] 所在的域，只限制在该域的CPU上，域内仍由操作系统调度。
+ * 线程数少于CPU数时各域分到的线程数也是均衡的
+ */
+void llc_build_order(void) {
+    int next[LLC_MAX_DOMAINS] = { 0 };
+    for (int d = 0; d < llc_domain_count; d++) CPU_ZERO(&llc_domain_cpus[d]);
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (llc_domain_of[c] >= 0) CPU_SET(c, &llc_domain_cpus[llc_domain_of[c]]);
+    }
+    llc_order_count = 0;
+    for (int added = 1; added; ) {
+        added = 0;
+        for (int d = 0; d < llc_domain_count; d++) {
+            while (next[d] < CPU_SETSIZE && !CPU_ISSET(next[d], &llc_domain_cpus[d])) next[d]++;
+            if (next[d] < CPU_SETSIZE) {
+                llc_order[llc_order_count++] = next[d]++;
+                added = 1;
+            }
+        }
+    }
+}
+
+/* id号线程的L3域：固定了CPU时是那个CPU的域，否则按llc_order轮流分配（-1表示未知） */
+int llc_worker_domain(int id) {
+    int cpu = placement_count ? placement_cpus[id % placement_count]
+            : llc_order_count ? llc_order[id % llc_order_count] : -1;
+    return cpu >= 0 && cpu < CPU_SETSIZE ? llc_domain_of[cpu] : -1;
+}
+
+/*
+ * 有多个L3域时，按原来的顺序把任务切成连续的段，每个域一段，各段的预测开销与
+ * 这一批实际使用的线程中该域的线程数成正比，段内再按开销从大到小排。
+ * 相邻的任务（二分拆分中相邻的叶子、同一层相邻的合并与乘法）的结果在下一层要合在一起，
+ * 留在同一个域里。返回队列数，只有一个域或任务太少时返回0（不分域）
+ */
+int task_split_domains(task_t *tasks, size_t count, int workers, task_queue_t *queues, int *queue_of_domain) {
+    pthread_once(&llc_once, llc_init);
+    if (llc_domain_count <= 1) return 0;
+    double weight[LLC_MAX_DOMAINS] = { 0 };
+    for (int i = 0; i < workers; i++) {
+        int d = llc_worker_domain(i);
+        if (d >= 0) weight[d]++;
+    }
+    int nqueues = 0;
+    double weight_sum = 0;
+    for (int d = 0; d < llc_domain_count; d++) {
+        queue_of_domain[d] = weight[d] > 0 ? nqueues++ : -1;
+        weight_sum += weight[d];
+    }
+    if (nqueues <= 1 || count < 2 * (size_t)nqueues) return 0;
+    
+    double total = 0;
+    for (size_t i = 0; i < count; i++) total += tasks[i].cost;
+    double target = 0, acc = 0;
+    size_t start = 0;
+    for (int d = 0; d < llc_domain_count; d++) {
+        int q = queue_of_domain[d];
+        if (q < 0) continue;
+        target += total * weight[d] / weight_sum;
+        size_t end = start;
+        if (q == nqueues - 1) {
+            end = count;
+        } else {
+            /* 任务中点不超过本段的目标就归本段；每段至少一个，给后面的段留够 */
+            size_t max_end = count - (size_t)(nqueues - 1 - q);
+            while (end < max_end && (end == start || acc + tasks[end].cost / 2 <= target)) {
+                acc += tasks[end++].cost;
+            }
+        }
+        qsort(tasks + start, end - start, sizeof(task_t), task_cost_cmp);
+        queues[q].tasks = tasks + start;
+        queues[q].range = end - start;
+        start = end;
+    }
+    return nqueues;
+}
+
+/* 能效核排在后面，每个核心的第一个逻辑CPU排在SMT兄弟前面，最后按编号 */
+int topo_cmp(const void *x, const void *y) {
+    const cpu_topo_t *a = x, *b = y;
+    int ea = a->type == CORE_TYPE_E, eb = b->type == CORE_TYPE_E;
+    if (ea != eb) return ea - eb;
+    if (a->sibling != b->sibling) return a->sibling - b->sibling;
+    return a->cpu - b->cpu;
+}
+
+/*
+ * 按策略选出CPU并排好顺序（0号线程用第一个），返回个数。
+ * 不是混合架构时pcore没有意义，按logical处理，policy改为实际使用的策略
+ */
+int placement_select(int *policy, int *cpus, int max) {
+    cpu_topo_t t[MAX_THREADS];
+    int hybrid;
+    int n = topology_read(t, MAX_THREADS, &hybrid);
+    if (*policy == PLACEMENT_PCORE && !hybrid) *policy = PLACEMENT_LOGICAL;
+    if (*policy != PLACEMENT_NONE) qsort(t, (size_t)n, sizeof(cpu_topo_t), topo_cmp);
+    int k = 0;
+    for (int i = 0; i < n && k < max; i++) {
+        if (*policy == PLACEMENT_PHYSICAL && t[i].sibling > 0) continue;
+        if (*policy == PLACEMENT_PCORE && t[i].type != CORE_TYPE_P) continue;
+        cpus[k++] = t[i].cpu;
+    }
+    return k;
+}
+
+/* 按策略确定各线程的CPU，把主线程（0号线程）固定到第一个；set_threads非0时线程数取CPU数 */
+int placement_setup(int policy, int set_threads) {
+    int effective = policy;
+    int n = placement_select(&effective, placement_cpus, MAX_THREADS);
+    if (effective != policy) {
+        fprintf(stderr, "警告: 没有找到/sys/devices/cpu_core和cpu_atom，不是混合架构，%s按%s处理\n",
+                placement_names[policy], placement_names[effective]);
+    }
+    if (n <= 0) {
+        fprintf(stderr, "错误: 放置策略 %s 没有可用的CPU\n", placement_names[policy]);
+        return 1;
+    }
+    if (set_threads) num_threads = n;
+    placement_count = effective == PLACEMENT_NONE ? 0 : n;
+    cpu_set_t set = original_affinity;
+    if (placement_count) {
+        CPU_ZERO(&set);
+        CPU_SET(placement_cpus[0], &set);
+    }
+    sched_setaffinity(0, sizeof(set), &set);
+    return 0;
+}
+
+/*
+ * run_tasks创建id号线程之前调用；线程数多于CPU数时循环使用。
+ * 不固定CPU时，如果任务按L3域分了队列（domain不是-1），把线程限制在该域的CPU上
+ */
+void placement_attr(pthread_attr_t *attr, int id, int domain) {
+    if (placement_count == 0) {
+        if (domain >= 0) pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &llc_domain_cpus[domain]);
+        return;
+    }
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(placement_cpus[id % placement_count], &one);
+    pthread_attr_setaffinity_np(attr, sizeof(one), &one);
+}
+
+/*
+ * 各放置策略各用自己选出的CPU数作线程数，计算同样的位数（短任务取多次的最小值），
+ * 与不固定线程（none）比较，报告最快的策略
+ */
+int placement_benchmark(uint64_t digits) {
+    cpu_topo_t t[MAX_THREADS];
+    int hybrid;
+    int n = topology_read(t, MAX_THREADS, &hybrid);
+    int cores = 0, smt = 1, pcpus = 0, ecpus = 0;
+    for (int i = 0; i < n; i++) {
+        if (t[i].sibling == 0) cores++;
+        if (t[i].sibling + 1 > smt) smt = t[i].sibling + 1;
+        if (t[i].type == CORE_TYPE_P) pcpus++;
+        if (t[i].type == CORE_TYPE_E) ecpus++;
+    }
+    printf("SuperPi - 线程放置对比（%s，%s算法，%llu 位）\n", constants[constant_id].name, algorithm_name(),
+           (unsigned long long)digits);
+    printf("拓扑: %d 个逻辑CPU，%d 个物理核心", n, cores);
+    if (smt > 1) printf("，%d路SMT", smt);
+    if (hybrid) printf("，性能核 %d 个、能效核 %d 个逻辑CPU", pcpus, ecpus);
+    printf("\n\n策略        线程  CPU                         耗时(秒)   相对none\n");
+    
+    quiet = 1;
+    double none_time = 0, best_time = 0;
+    int best = -1;
+    for (int p = 0; p < PLACEMENT_POLICIES && keep_running; p++) {
+        if (p == PLACEMENT_PCORE && !hybrid) {
+            printf("%-10s  不是混合架构，跳过\n", placement_names[p]);
+            continue;
+        }
+        int effective = p;
+        int cpus[MAX_THREADS];
+        int k = placement_select(&effective, cpus, MAX_THREADS);
+        if (k <= 0 || placement_setup(p, 1) != 0) continue;
+        double elapsed = bench_run(digits, k);
+        if (elapsed < 0) {
+            fprintf(stderr, "错误: %llu 位计算失败\n", (unsigned long long)digits);
+            quiet = 0;
+            return 1;
+        }
+        if (p == PLACEMENT_NONE) none_time = elapsed;
+        if (best < 0 || elapsed < best_time) best = p, best_time = elapsed;
+        char list[28];
+        format_cpu_list(cpus, k, list, sizeof(list));
+        printf("%-10s  %4d  %-26s %10.4f %9.2fx\n", placement_names[p], k, list, elapsed,
+               none_time > 0 ? none_time / elapsed : 1.0);
+        fflush(stdout);
+    }
+    quiet = 0;
+    placement_setup(PLACEMENT_NONE, 0);
+    if (!keep_running || best < 0) return 1;
+    printf("\n最快: %s（比none快 %.1f%%），可用 --placement=%s\n", placement_names[best],
+           100.0 * (none_time / best_time - 1), placement_names[best]);
+    return 0;
+}
+
+/* ===== 正确性测试 ===== */
+
+/*
+ * 每个测试先算到最大位数，用内置摘要确认结果正确，
+ * 再在各边界位数下单独计算，要求都是它的前缀。
+ * 边界位数覆盖1位、跨越常见的2的幂，以及π第762位起的六个9
+ * （在761、762位截断时最容易把舍入进位带进最后一位）。
+ */
+const uint64_t golden_sizes[] = { 1, 9, 10, 127, 128, 761, 762, 1000, 65536, 1000000 };
+
+typedef struct {
+    int constant;
+    int algorithm;            // 只对π有意义
+    int base;
+    uint64_t digits;          // 参考摘要对应的位数，也是该测试的最大位数
+    uint64_t digest;          // 与 --verify-file 相同的分块FNV-1a摘要
+} golden_t;
+
+const golden_t golden_cases[] = {
+    { CONST_PI,     ALGO_GAUSS_LEGENDRE, 10, 1000000, 0x474bdc7942f2358aULL },
+    { CONST_PI,     ALGO_CHUDNOVSKY,     10, 1000000, 0x474bdc7942f2358aULL },
+    { CONST_E,      ALGO_CHUDNOVSKY,     10,   65536, 0xd8965500539a1d39ULL },
+    { CONST_SQRT2,  ALGO_CHUDNOVSKY,     10,   65536, 0xa13c13c80d752450ULL },
+    { CONST_SQRT3,  ALGO_CHUDNOVSKY,     10,   65536, 0x0e76872b90c712cbULL },
+    { CONST_PHI,    ALGO_CHUDNOVSKY,     10,   65536, 0xc229a474c4ea5555ULL },
+    { CONST_LOG2,   ALGO_CHUDNOVSKY,     10,   65536, 0xeb5653fefc4abb8fULL },
+    { CONST_LOG10,  ALGO_CHUDNOVSKY,     10,   65536, 0x6ea0d67cc1ba5310ULL },
+    { CONST_ZETA3,  ALGO_CHUDNOVSKY,     10,   10000, 0x6973324f26cc2acaULL },
+    { CONST_CATALAN, ALGO_CHUDNOVSKY,    10,   10000, 0x2babd7c1d16cf846ULL },
+    { CONST_PI,     ALGO_CHUDNOVSKY,      2,   65536, 0x28d7a7429447fd72ULL },
+    { CONST_PI,     ALGO_CHUDNOVSKY,      7,   10000, 0xb4ce112cad45bc3cULL },
+    { CONST_PI,     ALGO_CHUDNOVSKY,     16,   32768, 0x9a356f58b1776533ULL },
+};
+
+/* 比较并打印一个测试结果，返回第一个不同的位置（从1数，0表示相同） */
+uint64_t golden_mismatch(const char *got, const char *expect, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        if (got[i] != expect[i]) return i + 1;
+    }
+    return 0;
+}
+
+/* 测一种配置：先算最大位数核对摘要，再逐个边界位数对比前缀 */
+int selftest_case(const golden_t *g) {
+    char *ref = NULL;
+    if (calculate_constant_digits(g->digits, &ref) == 0) {
+        printf("失败（%llu 位计算失败）\n", (unsigned long long)g->digits);
+        return 1;
+    }
+    if (digits_digest(ref, g->digits) != g->digest) {
+        printf("失败（%llu 位的摘要与参考值不同）\n", (unsigned long long)g->digits);
+        free(ref);
+        return 1;
+    }
+    int tested = 1;
+    for (size_t i = 0; i < sizeof(golden_sizes) / sizeof(golden_sizes[0]); i++) {
+        uint64_t n = golden_sizes[i];
+        if (n >= g->digits) break;
+        char *got = NULL;
+        uint64_t bad = calculate_constant_digits(n, &got) == 0 ? 1 : golden_mismatch(got, ref, n);
+        free(got);
+        if (bad) {
+            printf("失败（%llu 位时第 %llu 位错误）\n", (unsigned long long)n, (unsigned long long)bad);
+            free(ref);
+            return 1;
+        }
+        tested++;
+    }
+    printf("通过（%d 种位数，最多 %llu 位）\n", tested, (unsigned long long)g->digits);
+    free(ref);
+    return 0;
+}
+
+/* 把流式输出重定向到临时文件，检查前n位 */
+int selftest_stream(uint64_t n) {
+    FILE *tmp = tmpfile();
+    if (!tmp) return 1;
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    dup2(fileno(tmp), STDOUT_FILENO);
+    stream_pi_digits(n);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    
+    char buf[1024];
+    rewind(tmp);
+    size_t len = fread(buf, 1, sizeof(buf), tmp);
+    fclose(tmp);
+    return len < n + 2 || memcmp(buf, "3.", 2) != 0 || golden_mismatch(buf + 2, pi_prefix, n) != 0;
+}
+
+/*
+ * 伪造两个L3域（CPU 0到2在域0，CPU 3在域1），检查不固定CPU时线程的分域
+ * 和任务切分：切分按实际使用的线程数，而不是各域的CPU数
+ */
+int selftest_llc_split(void) {
+    static int saved_of[CPU_SETSIZE];
+    pthread_once(&llc_once, llc_init);
+    memcpy(saved_of, llc_domain_of, sizeof(saved_of));
+    int saved_count = llc_domain_count, saved_placement = placement_count;
+    for (int c = 0; c < CPU_SETSIZE; c++) llc_domain_of[c] = c < 3 ? 0 : c == 3 ? 1 : -1;
+    llc_domain_count = 2;
+    placement_count = 0;
+    llc_build_order();
+    
+    int bad = llc_worker_domain(0) != 0 || llc_worker_domain(1) != 1
+              || llc_worker_domain(2) != 0 || llc_worker_domain(3) != 0;
+    task_t tasks[8];
+    task_queue_t queues[LLC_MAX_DOMAINS];
+    int queue_of_domain[LLC_MAX_DOMAINS];
+    for (int i = 0; i < 8; i++) {
+        tasks[i].run = NULL;
+        tasks[i].arg = NULL;
+        tasks[i].cost = 1;
+    }
+    /* 2个线程各在一个域，对半分；4个线程3:1 */
+    bad |= task_split_domains(tasks, 8, 2, queues, queue_of_domain) != 2
+           || queues[0].range != 4 || queues[1].range != 4;
+    bad |= task_split_domains(tasks, 8, 4, queues, queue_of_domain) != 2
+           || queues[0].range != 6 || queues[1].range != 2;
+    
+    memcpy(llc_domain_of, saved_of, sizeof(saved_of));
+    llc_domain_count = saved_count;
+    placement_count = saved_placement;
+    llc_build_order();
+    return bad;
+}
+
+int run_selftest(void) {
+    int saved_constant = constant_id, saved_algorithm = pi_algorithm;
+    int saved_base = output_base, saved_threads = num_threads;
+    int failures = 0, total = 0;
+    double start = wall_time();
+    
+    /* 线程数取1、2、3（奇数会让二分拆分的任务划分不对称）和全部CPU */
+    int threads[4] = { 1, 2, 3, saved_threads };
+    int tc = saved_threads > 3 ? 4 : 3;
+    
+    printf("SuperPi - 正确性测试\n");
+    quiet = 1;
+    for (int t = 0; t < tc && keep_running; t++) {
+        num_threads = threads[t];
+        for (size_t i = 0; i < sizeof(golden_cases) / sizeof(golden_cases[0]) && keep_running; i++) {
+            const golden_t *g = &golden_cases[i];
+            constant_id = g->constant;
+            pi_algorithm = g->algorithm;
+            output_base = g->base;
+            printf("  %s %s %d进制 %d线程: ", constants[constant_id].name, algorithm_name(),
+                   output_base, num_threads);
+            fflush(stdout);
+            failures += selftest_case(g);
+            total++;
+        }
+    }
+    constant_id = saved_constant;
+    pi_algorithm = saved_algorithm;
+    output_base = saved_base;
+    num_threads = saved_threads;
+    
+    /* 流式输出和数字提取与内置前缀对比 */
+    const uint64_t stream_sizes[] = { 1, 9, 10, 761, 762, 1000 };
+    int bad = 0;
+    for (size_t i = 0; i < sizeof(stream_sizes) / sizeof(stream_sizes[0]); i++) {
+        bad |= selftest_stream(stream_sizes[i]);
+    }
+    printf("  流式输出 spigot: %s\n", bad ? "失败" : "通过");
+    failures += bad;
+    total++;
+    
+    const uint64_t extract_pos[] = { 1, 755, 761, 762, 994 };
+    bad = 0;
+    for (size_t i = 0; i < sizeof(extract_pos) / sizeof(extract_pos[0]); i++) {
+        char out[10];
+        pi_digits_at(extract_pos[i], out);
+        bad |= golden_mismatch(out, pi_prefix + extract_pos[i] - 1, EXTRACT_GOOD_DIGITS) != 0;
+    }
+    printf("  数字提取 Bellard: %s\n", bad ? "失败" : "通过");
+    failures += bad;
+    total++;
+    
+    /* 第762位起是六个9：截到761位时要看到第768位才能确认，否则只能确认前760位 */
+    bad = certify_prefix(pi_prefix, 761, 767, 10) != 760
+          || certify_prefix(pi_prefix, 761, 768, 10) != 761
+          || certify_prefix("0110", 2, 4, 2) != 2
+          || certify_prefix("0111", 2, 4, 2) != 0;
+    printf("  末位验证: %s\n", bad ? "失败" : "通过");
+    failures += bad;
+    total++;
+    
+    bad = selftest_llc_split();
+    printf("  L3域划分: %s\n", bad ? "失败" : "通过");
+    failures += bad;
+    total++;
+    quiet = 0;
+    
+    printf("%d 项测试，%d 项失败，耗时 %.1f 秒\n", total, failures, wall_time() - start);
+    return failures ? 1 : 0;
+}
+
+/* ===== 心跳与看门狗（--watchdog） ===== */
+
+/*
+ * 每个计算线程在迭代和任务边界（progress_post和调度器取任务时）记一次心跳。
+ * 看门狗不知道一步该算多久，用这个线程自己见过的最长心跳间隔来估计：
+ * 超过它的WATCHDOG_FACTOR倍、并且不少于--watchdog秒还没有心跳，就认为停住了。
+ * 持续计算每轮位数翻倍，最长间隔按mul_work折算到新一轮的位数上。
+ */
+#define WATCHDOG_FACTOR 10            // 超过最长心跳间隔的这么多倍算停住
+#define WATCHDOG_POLL_MS 500          // 持续计算时看门狗线程的检查间隔
+
+/* 一个线程的心跳，只有它自己写，看门狗读 */
+typedef struct {
+    uint64_t beat_ns;         // 最近一次心跳（单调时钟，纳秒）
+    uint64_t max_gap_ns;      // 计算中见过的最长心跳间隔，已折算到本轮位数
+    uint64_t round_work;      // 本轮位数上一次乘法的开销（mul_work），用于折算
+    uint64_t step, steps;     // 最近一步是本阶段的第几步/共几步
+    int state;
+    int phase;
+    int cpu;                  // 最近一次心跳时所在的CPU
+    int tid;
+} heartbeat_t;
+
+heartbeat_t *heartbeats = NULL;  // 每个调度器线程一个（压力测试的子进程只有一个）
+int heartbeat_count = 0;
+double watchdog_first = 0;       // 还没见过心跳间隔时的阈值（秒），0表示只用--watchdog
+
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+heartbeat_t *heartbeat_self(void) {
+    return heartbeats && progress_slot < heartbeat_count ? &heartbeats[progress_slot] : NULL;
+}
+
+void heartbeat_beat(int phase, uint64_t step, uint64_t steps) {
+    heartbeat_t *h = heartbeat_self();
+    if (!h) return;
+    uint64_t now = monotonic_ns();
+    uint64_t gap = now - __atomic_load_n(&h->beat_ns, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&h->state, __ATOMIC_RELAXED) == HEARTBEAT_RUN && gap > h->max_gap_ns) {
+        __atomic_store_n(&h->max_gap_ns, gap, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&h->phase, phase, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->step, step, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->steps, steps, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->cpu, sched_getcpu(), __ATOMIC_RELAXED);
+    __atomic_store_n(&h->beat_ns, now, __ATOMIC_RELEASE);
+}
+
+int heartbeat_state(int state) {
+    heartbeat_t *h = heartbeat_self();
+    if (!h) return HEARTBEAT_IDLE;
+    int old = __atomic_load_n(&h->state, __ATOMIC_RELAXED);
+    if (state == HEARTBEAT_RUN && old != HEARTBEAT_RUN) {
+        /* 空闲和等待的时间不算心跳间隔 */
+        h->tid = (int)syscall(SYS_gettid);
+        __atomic_store_n(&h->beat_ns, monotonic_ns(), __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&h->state, state, __ATOMIC_RELEASE);
+    return old;
+}
+
+/* 调度器的线程取到一个任务；任务函数不知道阶段，沿用调用者线程当前的阶段 */
+void heartbeat_task(void) {
+    heartbeat_t *h = heartbeat_self();
+    if (!h) return;
+    heartbeat_beat(__atomic_load_n(&heartbeats[0].phase, __ATOMIC_RELAXED), h->step, h->steps);
+}
+
+/* 新一轮开始（在调用者线程上，此时没有其他计算线程），把各线程的最长间隔折算到新位数 */
+void heartbeat_round(uint64_t digits) {
+    uint64_t work = (uint64_t)mul_work((double)digits_to_bits(digits));
+    for (int i = 0; i < heartbeat_count; i++) {
+        heartbeat_t *h = &heartbeats[i];
+        if (h->round_work && h->max_gap_ns) {
+            __atomic_store_n(&h->max_gap_ns, (uint64_t)((double)h->max_gap_ns * work / h->round_work),
+                             __ATOMIC_RELAXED);
+        }
+        h->round_work = work;
+    }
+    heartbeat_state(HEARTBEAT_RUN);
+    heartbeat_beat(PHASE_NONE, 0, 0);
+}
+
+/* 判定停住的阈值（秒） */
+double watchdog_limit(const heartbeat_t *h) {
+    uint64_t gap = __atomic_load_n(&h->max_gap_ns, __ATOMIC_RELAXED);
+    double expect = gap ? WATCHDOG_FACTOR * gap / 1e9 : watchdog_first;
+    return expect > watchdog_seconds ? expect : watchdog_seconds;
+}
+
+/* 正在计算且超过阈值没有心跳时返回已经停住的秒数，否则返回0 */
+double watchdog_overdue(const heartbeat_t *h, uint64_t now) {
+    if (watchdog_seconds <= 0 || __atomic_load_n(&h->state, __ATOMIC_ACQUIRE) != HEARTBEAT_RUN) return 0;
+    uint64_t beat = __atomic_load_n(&h->beat_ns, __ATOMIC_ACQUIRE);
+    double idle = now > beat ? (now - beat) / 1e9 : 0;
+    return idle > watchdog_limit(h) ? idle : 0;
+}
+
+/* 线程（或进程）在内核里的状态：R运行、S睡眠、D不可中断等待等，读不到时为? */
+char task_state(int pid, int tid) {
+    char path[64], buf[512];
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", pid, tid);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return '?';
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+    const char *p = strrchr(buf, ')');  // 第二项是带括号的命令名，可能含空格
+    return p && p[1] == ' ' && p[2] ? p[2] : '?';
+}
+
+/* 在标准错误上列出所有心跳，label是每一行的名字（如"线程 3"） */
+void watchdog_dump_one(const char *label, const heartbeat_t *h, int pid, uint64_t now) {
+    static const char *state_names[] = { "空闲", "计算", "等待" };
+    int state = __atomic_load_n(&h->state, __ATOMIC_ACQUIRE);
+    int phase = __atomic_load_n(&h->phase, __ATOMIC_RELAXED);
+    uint64_t beat = __atomic_load_n(&h->beat_ns, __ATOMIC_ACQUIRE);
+    if (beat == 0) {
+        fprintf(stderr, "  %-10s 没有参与计算\n", label);
+        return;
+    }
+    fprintf(stderr, "  %-10s CPU %3d  %s  阶段 %-7s 第 %llu/%llu 步  %.1f 秒前心跳  最长间隔 %.2f 秒  "
+            "阈值 %.1f 秒  内核状态 %c\n",
+            label, __atomic_load_n(&h->cpu, __ATOMIC_RELAXED), state_names[state],
+            phase > 0 && phase < PROGRESS_PHASES ? progress_phase_names[phase] : "-",
+            (unsigned long long)__atomic_load_n(&h->step, __ATOMIC_RELAXED),
+            (unsigned long long)__atomic_load_n(&h->steps, __ATOMIC_RELAXED),
+            now > beat ? (now - beat) / 1e9 : 0, __atomic_load_n(&h->max_gap_ns, __ATOMIC_RELAXED) / 1e9,
+            watchdog_limit(h), h->tid ? task_state(pid, h->tid) : '?');
+}
+
+/* 报告停住的线程 */
+void watchdog_report(const char *label, const heartbeat_t *h, double idle) {
+    int phase = __atomic_load_n(&h->phase, __ATOMIC_RELAXED);
+    fprintf(stderr, "\n看门狗: %s（CPU %d）已经 %.1f 秒没有进展（阈值 %.1f 秒），停在%s阶段第 %llu/%llu 步\n",
+            label, __atomic_load_n(&h->cpu, __ATOMIC_RELAXED), idle, watchdog_limit(h),
+            phase > 0 && phase < PROGRESS_PHASES ? progress_phase_names[phase] : "开始",
+            (unsigned long long)__atomic_load_n(&h->step, __ATOMIC_RELAXED),
+            (unsigned long long)__atomic_load_n(&h->steps, __ATOMIC_RELAXED));
+}
+
+/* ===== 后台模式（--background） ===== */
+
+/*
+ * 在生产服务器上做低优先级的持续校验，尽量不影响其他程序：
+ * 1. 计算线程都用SCHED_IDLE，只用别人不用的CPU时间。策略按线程继承，
+ *    在创建任何线程之前对主线程设置一次即可（压力测试的子进程也继承）。
+ * 2. 占用上限：每个计算线程一个按本线程CPU时间计时的定时器，每用满一个时间片
+ *    就在信号处理函数里睡一段时间。GMP的一次大乘法可能要几秒，只在迭代边界限速太粗。
+ * 3. 每秒读一次/proc/pressure/cpu，有任务在等CPU的时间比例高时线程数减半，
+ *    低时加一（乘性减、加性增），run_tasks按thread_limit取线程数。
+ */
+#define BACKGROUND_SLICE_MS 10          // 限速时间片（本线程的CPU时间）
+#define BACKGROUND_POLL_MS 1000         // 检查CPU压力的间隔
+#define BACKGROUND_PRESSURE_HIGH 0.10   // 有任务等CPU的时间超过10%时收缩
+#define BACKGROUND_PRESSURE_LOW 0.02    // 低于2%时逐个恢复
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid  // 较旧的glibc没有定义这个名字
+#endif
+
+__thread timer_t throttle_timer;
+__thread int throttle_armed = 0;
+struct timespec throttle_pause;         // 每个时间片之后暂停的时长
+
+double psi_last_total = -1, psi_last_wall = 0;  // 上次读到的累计等待时间（微秒）和时刻
+double background_origin = 0, background_cpu0 = 0;
+double background_thread_seconds = 0;   // 线程数上限对时间的积分，除以积分的时长得平均线程数
+double background_thread_wall = 0;
+uint64_t background_digits = 0;         // 单次和持续计算中算完的位数
+
+void throttle_signal(int sig) {
+    (void)sig;
+    int saved = errno;
+    nanosleep(&throttle_pause, NULL);
+    errno = saved;
+}
+
+void throttle_begin(void) {
+    if (background_duty >= 100 || throttle_armed) return;
+    struct sigevent ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.sigev_notify = SIGEV_THREAD_ID;
+    ev.sigev_signo = SIGRTMIN;
+    ev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &ev, &throttle_timer) != 0) return;
+    struct itimerspec its;
+    its.it_value.tv_sec = its.it_interval.tv_sec = 0;
+    its.it_value.tv_nsec = its.it_interval.tv_nsec = BACKGROUND_SLICE_MS * 1000000L;
+    timer_settime(throttle_timer, 0, &its, NULL);
+    throttle_armed = 1;
+}
+
+void throttle_end(void) {
+    if (!throttle_armed) return;
+    timer_delete(throttle_timer);
+    throttle_armed = 0;
+}
+
+/* 在创建任何线程之前调用：切换到SCHED_IDLE，按占用上限给主线程限速 */
+void background_enter(void) {
+    struct sched_param sp = { 0 };
+    if (sched_setscheduler(0, SCHED_IDLE, &sp) != 0) {
+        fprintf(stderr, "警告: 无法使用SCHED_IDLE（%s），改为nice 19\n", strerror(errno));
+        if (setpriority(PRIO_PROCESS, 0, 19) != 0) {
+            fprintf(stderr, "警告: 无法降低优先级（%s）\n", strerror(errno));
+        }
+    }
+    if (background_duty < 100) {
+        double pause_ms = BACKGROUND_SLICE_MS * (100 - background_duty) / background_duty;
+        throttle_pause.tv_sec = (time_t)(pause_ms / 1000);
+        throttle_pause.tv_nsec = (long)((pause_ms - throttle_pause.tv_sec * 1000.0) * 1e6);
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = throttle_signal;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGRTMIN, &sa, NULL);
+        throttle_begin();
+    }
+    thread_limit = num_threads;
+    background_origin = wall_time();
+    background_cpu0 = cpu_time();
+}
+
+/* /proc/pressure/cpu中some一行的累计等待时间（微秒），内核不支持PSI时返回-1 */
+double cpu_pressure_total(void) {
+    FILE *fp = fopen("/proc/pressure/cpu", "r");
+    if (!fp) return -1;
+    char line[256];
+    double total = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        const char *p = strstr(line, "total=");
+        if (strncmp(line, "some ", 5) == 0 && p) total = strtod(p + 6, NULL);
+    }
+    fclose(fp);
+    return total;
+}
+
+/* 按上次以来的CPU压力调整线程数（1到max之间），返回新的线程数 */
+int background_adjust(int current, int max) {
+    double total = cpu_pressure_total(), now = wall_time();
+    if (total < 0) {
+        if (psi_last_total == -1 && !tui_mode) {
+            fprintf(stderr, "警告: 读不到/proc/pressure/cpu，不会按CPU压力调整线程数\n");
+        }
+        psi_last_total = -2;  // 只警告一次
+        return current;
+    }
+    double pressure = psi_last_total >= 0 && now > psi_last_wall
+                    ? (total - psi_last_total) / 1e6 / (now - psi_last_wall) : 0;
+    psi_last_total = total;
+    psi_last_wall = now;
+    int next = current;
+    if (pressure > BACKGROUND_PRESSURE_HIGH && current > 1) next = current / 2;
+    if (pressure < BACKGROUND_PRESSURE_LOW && current < max) next = current + 1;
+    if (next != current && !tui_mode) {
+        fprintf(stderr, "后台模式: CPU压力 %.0f%%，线程数 %d -> %d\n", pressure * 100, current, next);
+    }
+    return next;
+}
+
+/* 报告后台模式的实际吞吐量和资源占用，threads为平均线程数 */
+void background_report(uint64_t digits, double seconds, double cpu, double threads) {
+    if (seconds <= 0) return;
+    printf("后台模式: %.1f 秒内共算完 %llu 位，吞吐量 %.0f 位/秒，平均占用 %.2f 个CPU",
+           seconds, (unsigned long long)digits, digits / seconds, cpu / seconds);
+    if (background_duty < 100) printf("（每线程上限 %.0f%%）", background_duty);
+    printf("，平均 %.1f 个线程\n", threads);
+}
+
+/* 单次和持续计算结束时的报告 */
+void background_summary(void) {
+    double threads = background_thread_wall > 0 ? background_thread_seconds / background_thread_wall : thread_limit;
+    background_report(background_digits, wall_time() - background_origin, cpu_time() - background_cpu0, threads);
+}
+
+/* ===== 压力测试、仪表盘与指标文件（--stress、--tui、--metrics-file） ===== */
+
+/*
+ * 压力测试在每个CPU上各跑一个单线程的子进程，反复计算同一个结果并与参考结果对比。
+ * 用进程而不用线程：筛表、调度器和GMP默认精度这些全局状态不必改成线程安全，
+ * 一个核心算错崩溃了也不会带走其他核心。计数器放在共享匿名内存里，
+ * 子进程每轮只做几次relaxed原子写，仪表盘每秒读几次，不影响计算。
+ */
+#define STRESS_POLL_MS 100            // 逐行输出时父进程检查计数器的间隔
+#define TUI_REFRESH_MS 250            // 仪表盘刷新间隔
+#define TUI_MAX_ROWS 64               // 仪表盘最多显示的CPU数
+
+#define WORKER_IDLE    0
+#define WORKER_COMPUTE 1
+#define WORKER_VERIFY  2
+#define WORKER_FAILED  3   // 最近一轮与参考结果不符
+#define WORKER_EXITED  4   // 子进程异常退出
+#define WORKER_PARKED  5   // 后台模式因CPU压力暂停
+const char *worker_state_names[] = { "等待", "计算", "校验", "出错", "退出", "暂停" };
+
+/* 一个计算者（压力测试的子进程或持续计算的主线程）的计数器，都用原子读写 */
+typedef struct {
+    int cpu;                  // 固定到的CPU（-1表示不固定）
+    pid_t pid;
+    int state;
+    uint64_t digits;          // 当前一轮的位数
+    uint64_t rounds;          // 完成的轮数（含出错的）
+    uint64_t errors;          // 出错的轮数
+    uint64_t checked;         // 与参考值或上一轮结果对比过的轮数
+    uint64_t first_bad;       // 最近一次出错时第一个不符的位置（从1开始）
+    uint64_t digits_done;     // 累计算完的位数
+    uint64_t round_ns;        // 最近一轮的耗时（纳秒）
+    uint64_t compute_ns;      // 累计求值耗时（纳秒）
+    uint64_t convert_ns;      // 累计转换耗时（纳秒）
+    uint64_t peak_rss_kb;     // 所在进程的内存峰值
+    heartbeat_t hb;           // 压力测试子进程的心跳，父进程据此判断是否停住
+    char pad[64];             // 避免相邻计数器共享缓存行
+} stress_worker_t;
+
+/* 仪表盘的状态：每个CPU的传感器路径和上次的CPU时间 */
+typedef struct {
+    int rows;
+    int cpu[TUI_MAX_ROWS];
+    char temp_path[TUI_MAX_ROWS][128];
+    uint64_t busy[TUI_MAX_ROWS], total[TUI_MAX_ROWS];
+    double start;
+} tui_t;
+
+/* 单次和持续计算的计数器，计算在主线程里，仪表盘和指标文件各一个线程读取 */
+stress_worker_t *run_worker = NULL;
+pthread_t tui_thread, metrics_thread, watchdog_thread, background_thread;
+int run_stats_running = 0;    // 这几个线程是否继续（原子读写）
+double run_stats_origin = 0;
+
+int read_long_file(const char *path, long *value) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    int ok = fscanf(fp, "%ld", value) == 1;
+    fclose(fp);
+    return ok ? 0 : -1;
+}
+
+/* 当前可用的CPU，最多max个，返回个数 */
+int allowed_cpus(int *cpus, int max) {
+    if (placement_count) {  // 按放置策略的顺序
+        int n = placement_count < max ? placement_count : max;
+        memcpy(cpus, placement_cpus, (size_t)n * sizeof(int));
+        return n;
+    }
+    cpu_set_t allowed;
+    int n = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int c = 0; c < CPU_SETSIZE && n < max; c++) {
+            if (CPU_ISSET(c, &allowed)) cpus[n++] = c;
+        }
+    }
+    if (n == 0) {  // 取不到时按编号
+        while (n < max && n < num_threads) cpus[n] = n, n++;
+    }
+    return n;
+}
+
+/*
+ * 找到CPU温度的文件：优先coretemp里与该CPU的core_id对应的“Core N”，
+ * 其次k10temp/zenpower等的第一个温度（整个封装），最后是thermal_zone0
+ */
+void find_temp_path(int cpu, char *out, size_t size) {
+    char path[PATH_MAX], name[64], label[64];
+    long core_id = -1, v;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+    read_long_file(path, &core_id);
+    out[0] = '\0';
+    
+    DIR *dir = opendir("/sys/class/hwmon");
+    struct dirent *de;
+    while (dir && (de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "/sys/class/hwmon/%s/name", de->d_name);
+        FILE *fp = fopen(path, "r");
+        if (!fp) continue;
+        int ok = fscanf(fp, "%63s", name) == 1;
+        fclose(fp);
+        if (!ok || (strcmp(name, "coretemp") != 0 && strcmp(name, "k10temp") != 0
+                    && strcmp(name, "zenpower") != 0)) continue;
+        for (int i = 1; i < 256; i++) {
+            snprintf(path, sizeof(path), "/sys/class/hwmon/%s/temp%d_label", de->d_name, i);
+            fp = fopen(path, "r");
+            if (!fp) continue;
+            ok = fgets(label, sizeof(label), fp) != NULL;
+            fclose(fp);
+            int core;
+            int match = ok && sscanf(label, "Core %d", &core) == 1 && core == core_id;
+            if (match || out[0] == '\0') {
+                snprintf(out, size, "/sys/class/hwmon/%s/temp%d_input", de->d_name, i);
+            }
+            if (match) break;
+        }
+        if (out[0]) break;
+    }
+    if (dir) closedir(dir);
+    if (!out[0] && read_long_file("/sys/class/thermal/thermal_zone0/temp", &v) == 0) {
+        snprintf(out, size, "/sys/class/thermal/thermal_zone0/temp");
+    }
+}
+
+void tui_init(tui_t *t, const stress_worker_t *w, int nw) {
+    memset(t, 0, sizeof(*t));
+    t->start = wall_time();
+    if (nw > 0 && w[0].cpu >= 0) {  // 压力测试：显示各子进程所在的CPU
+        for (int i = 0; i < nw && i < TUI_MAX_ROWS; i++) t->cpu[t->rows++] = w[i].cpu;
+    } else {
+        t->rows = allowed_cpus(t->cpu, TUI_MAX_ROWS);
+    }
+    for (int i = 0; i < t->rows; i++) find_temp_path(t->cpu[i], t->temp_path[i], sizeof(t->temp_path[i]));
+    printf("\033[?25l\033[2J");  // 隐藏光标并清屏
+}
+
+void tui_finish(void) {
+    printf("\033[?25h\n");
+    fflush(stdout);
+}
+
+/* 从/proc/stat读出各CPU自上次以来的占用率（百分比），读不到的为-1 */
+void tui_usage(tui_t *t, double *usage) {
+    for (int i = 0; i < t->rows; i++) usage[i] = -1;
+    FILE *fp = fopen("/proc/stat", "r");
+    if (!fp) return;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        int cpu;
+        unsigned long long v[8] = { 0 };
+        if (sscanf(line, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu", &cpu,
+                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) < 5) continue;
+        uint64_t total = 0;
+        for (int k = 0; k < 8; k++) total += v[k];
+        uint64_t busy = total - v[3] - v[4];  // 去掉idle和iowait
+        for (int i = 0; i < t->rows; i++) {
+            if (t->cpu[i] != cpu) continue;
+            if (t->total[i] && total > t->total[i]) {
+                usage[i] = 100.0 * (double)(busy - t->busy[i]) / (double)(total - t->total[i]);
+            }
+            t->busy[i] = busy;
+            t->total[i] = total;
+        }
+    }
+    fclose(fp);
+}
+
+/* 一行的计数列：label是CPU编号或“全部”，wk为NULL时只显示占用、频率和温度 */
+void tui_row(FILE *out, const char *label, const stress_worker_t *wk,
+             const char *usage, const char *freq, const char *temp) {
+    char last[32];
+    if (!wk) {
+        fprintf(out, "%4s  %-4s  %8s %7s %10s %6s %9s %7s\033[K\n", label, "-", "-", "-", "-",
+                usage, freq, temp);
+        return;
+    }
+    int state = __atomic_load_n(&wk->state, __ATOMIC_RELAXED);
+    uint64_t ns = __atomic_load_n(&wk->round_ns, __ATOMIC_RELAXED);
+    if (ns) {
+        snprintf(last, sizeof(last), "%.2f秒", ns / 1e9);
+    } else {
+        snprintf(last, sizeof(last), "-");
+    }
+    const char *color = state == WORKER_FAILED || state == WORKER_EXITED ? "\033[1;31m" : "";
+    fprintf(out, "%s%4s  %s  %8llu %7llu %10s %6s %9s %7s\033[0m\033[K\n", color, label,
+            worker_state_names[state],
+            (unsigned long long)__atomic_load_n(&wk->rounds, __ATOMIC_RELAXED),
+            (unsigned long long)__atomic_load_n(&wk->errors, __ATOMIC_RELAXED),
+            last, usage, freq, temp);
+}
+
+/*
+ * 画一帧：标题、汇总和每个CPU一行；整帧一次写出，避免闪烁。
+ * 持续计算（--keep）只有一个不固定CPU的计算，用所有线程，
+ * 它的计数单独成一个“全部”行，下面各CPU行只显示占用、频率和温度
+ */
+void tui_render(tui_t *t, const char *title, const stress_worker_t *w, int nw, uint64_t rss_kb) {
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&buf, &size);
+    if (!out) return;
+    
+    double elapsed = wall_time() - t->start;
+    uint64_t rounds = 0, errors = 0, done = 0;
+    for (int i = 0; i < nw; i++) {
+        rounds += __atomic_load_n(&w[i].rounds, __ATOMIC_RELAXED);
+        errors += __atomic_load_n(&w[i].errors, __ATOMIC_RELAXED);
+        done += __atomic_load_n(&w[i].digits_done, __ATOMIC_RELAXED);
+    }
+    long s = (long)elapsed;
+    fprintf(out, "\033[H\033[1m%s\033[0m  运行 %ld:%02ld:%02ld  （Ctrl+C 停止）\033[K\n",
+            title, s / 3600, s / 60 % 60, s % 60);
+    fprintf(out, "轮数 %llu   错误 %s%llu\033[0m   速度 %.3g 位/秒   内存 %.1f MB\033[K\n\033[K\n",
+            (unsigned long long)rounds, errors ? "\033[1;31m" : "", (unsigned long long)errors,
+            elapsed > 0 ? (double)done / elapsed : 0.0, rss_kb / 1024.0);
+    fprintf(out, " CPU  状态      轮数    错误    上一轮    占用      频率    温度\033[K\n");
+    
+    double usage[TUI_MAX_ROWS];
+    tui_usage(t, usage);
+    if (nw == 1 && w[0].cpu < 0) {
+        double sum = 0;
+        int known = 0;
+        char col[32];
+        for (int i = 0; i < t->rows; i++) {
+            if (usage[i] >= 0) {
+                sum += usage[i];
+                known++;
+            }
+        }
+        if (known) {
+            snprintf(col, sizeof(col), "%.0f%%", sum / known);
+        } else {
+            snprintf(col, sizeof(col), "-");
+        }
+        tui_row(out, "全部", &w[0], col, "-", "-");
+    }
+    for (int i = 0; i < t->rows; i++) {
+        char path[PATH_MAX], label[16], col[3][32];
+        long v;
+        const stress_worker_t *wk = NULL;
+        for (int j = 0; j < nw; j++) {
+            if (w[j].cpu == t->cpu[i]) wk = &w[j];
+        }
+        if (usage[i] >= 0) {
+            snprintf(col[0], sizeof(col[0]), "%.0f%%", usage[i]);
+        } else {
+            snprintf(col[0], sizeof(col[0]), "-");
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", t->cpu[i]);
+        if (read_long_file(path, &v) == 0) {
+            snprintf(col[1], sizeof(col[1]), "%.2fGHz", v / 1e6);
+        } else {
+            snprintf(col[1], sizeof(col[1]), "-");
+        }
+        if (t->temp_path[i][0] && read_long_file(t->temp_path[i], &v) == 0) {
+            snprintf(col[2], sizeof(col[2]), "%ld°C", v / 1000);
+        } else {
+            snprintf(col[2], sizeof(col[2]), "-");
+        }
+        snprintf(label, sizeof(label), "%d", t->cpu[i]);
+        tui_row(out, label, wk, col[0], col[1], col[2]);
+    }
+    fprintf(out, "\033[J");
+    fclose(out);
+    fwrite(buf, 1, size, stdout);
+    fflush(stdout);
+    free(buf);
+}
+
+/* 记录一轮的结果：bad为第一个不符的位置（0表示通过），checked表示这一轮是否对比过 */
+void worker_finish_round(stress_worker_t *w, uint64_t digits, uint64_t bad, int checked, double seconds) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        __atomic_store_n(&w->peak_rss_kb, (uint64_t)ru.ru_maxrss, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&w->compute_ns, (uint64_t)(phase_compute * 1e9), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&w->convert_ns, (uint64_t)(phase_convert * 1e9), __ATOMIC_RELAXED);
+    __atomic_store_n(&w->round_ns, (uint64_t)(seconds * 1e9), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&w->digits_done, digits, __ATOMIC_RELAXED);
+    if (checked) __atomic_fetch_add(&w->checked, 1, __ATOMIC_RELAXED);
+    if (bad) {
+        __atomic_store_n(&w->first_bad, bad, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&w->errors, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&w->state, bad ? WORKER_FAILED : WORKER_IDLE, __ATOMIC_RELAXED);
+    /* 轮数最后写，逐行输出时父进程据此读取本轮的其他字段 */
+    __atomic_fetch_add(&w->rounds, 1, __ATOMIC_RELEASE);
+}
+
+/* 本进程的内存峰值（KB） */
+uint64_t peak_rss_kb(void) {
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? (uint64_t)ru.ru_maxrss : 0;
+}
+
+/*
+ * 把计数器写成Prometheus文本格式，供node_exporter的textfile收集器读取
+ * 先写同目录下的临时文件（不以.prom结尾，收集器不会读）再rename，
+ * 收集器不会读到写了一半的文件。peak_kb是所有计算进程的内存峰值之和
+ */
+int metrics_write(const stress_worker_t *w, int n, double elapsed, uint64_t peak_kb) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", metrics_path);
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) return -1;
+    
+    uint64_t errors = 0, checked = 0, done = 0, compute_ns = 0, convert_ns = 0, digits = 0;
+    int exited = 0;
+    for (int i = 0; i < n; i++) {
+        errors += __atomic_load_n(&w[i].errors, __ATOMIC_RELAXED);
+        checked += __atomic_load_n(&w[i].checked, __ATOMIC_RELAXED);
+        done += __atomic_load_n(&w[i].digits_done, __ATOMIC_RELAXED);
+        compute_ns += __atomic_load_n(&w[i].compute_ns, __ATOMIC_RELAXED);
+        convert_ns += __atomic_load_n(&w[i].convert_ns, __ATOMIC_RELAXED);
+        digits = __atomic_load_n(&w[i].digits, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&w[i].state, __ATOMIC_RELAXED) == WORKER_EXITED) exited++;
+    }
+    
+    fprintf(fp, "# HELP superpi_info 程序版本和计算配置\n# TYPE superpi_info gauge\n");
+    fprintf(fp, "superpi_info{version=\"%s\",constant=\"%s\",algorithm=\"%s\",base=\"%d\"} 1\n",
+            GIT_VERSION, constants[constant_id].option, pi_algorithm == ALGO_CHUDNOVSKY ? "chudnovsky" : "gl",
+            output_base);
+    /* 每个计算者一组，压力测试按CPU编号，单次和持续计算标为all */
+    static const char *per_worker[][3] = {
+        { "superpi_rounds_total", "counter", "完成的计算轮数" },
+        { "superpi_failures_total", "counter", "结果出错的轮数" },
+        { "superpi_last_round_seconds", "gauge", "最近一轮的耗时" },
+    };
+    for (int m = 0; m < 3; m++) {
+        fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", per_worker[m][0], per_worker[m][2],
+                per_worker[m][0], per_worker[m][1]);
+        for (int i = 0; i < n; i++) {
+            char cpu[16];
+            snprintf(cpu, sizeof(cpu), w[i].cpu >= 0 ? "%d" : "all", w[i].cpu);
+            fprintf(fp, "%s{cpu=\"%s\"} ", per_worker[m][0], cpu);
+            if (m == 0) fprintf(fp, "%llu\n", (unsigned long long)__atomic_load_n(&w[i].rounds, __ATOMIC_RELAXED));
+            if (m == 1) fprintf(fp, "%llu\n", (unsigned long long)__atomic_load_n(&w[i].errors, __ATOMIC_RELAXED));
+            if (m == 2) fprintf(fp, "%.6f\n", __atomic_load_n(&w[i].round_ns, __ATOMIC_RELAXED) / 1e9);
+        }
+    }
+    fprintf(fp, "# HELP superpi_phase_seconds_total 各阶段累计耗时\n# TYPE superpi_phase_seconds_total counter\n");
+    fprintf(fp, "superpi_phase_seconds_total{phase=\"compute\"} %.6f\n", compute_ns / 1e9);
+    fprintf(fp, "superpi_phase_seconds_total{phase=\"convert\"} %.6f\n", convert_ns / 1e9);
+    fprintf(fp, "# HELP superpi_digits 每轮计算的位数\n# TYPE superpi_digits gauge\nsuperpi_digits %llu\n",
+            (unsigned long long)digits);
+    fprintf(fp, "# HELP superpi_digits_per_second 运行以来的平均速度\n# TYPE superpi_digits_per_second gauge\n");
+    fprintf(fp, "superpi_digits_per_second %.3f\n", elapsed > 0 ? done / elapsed : 0.0);
+    fprintf(fp, "# HELP superpi_peak_memory_bytes 计算进程的内存峰值\n# TYPE superpi_peak_memory_bytes gauge\n");
+    fprintf(fp, "superpi_peak_memory_bytes %llu\n", (unsigned long long)peak_kb * 1024);
+    fprintf(fp, "# HELP superpi_workers_exited 异常退出的计算进程数\n# TYPE superpi_workers_exited gauge\n");
+    fprintf(fp, "superpi_workers_exited %d\n", exited);
+    /* 还没有对比过任何结果（单次计算、持续计算的第一轮）时不知道对不对，不输出这一项 */
+    if (checked || errors || exited) {
+        fprintf(fp, "# HELP superpi_verification_ok 到目前为止对比过的结果都正确为1\n# TYPE superpi_verification_ok gauge\n");
+        fprintf(fp, "superpi_verification_ok %d\n", errors == 0 && exited == 0);
+    }
+    fprintf(fp, "# HELP superpi_uptime_seconds 运行时长\n# TYPE superpi_uptime_seconds gauge\n");
+    fprintf(fp, "superpi_uptime_seconds %.3f\n", elapsed);
+    
+    int failed = ferror(fp);
+    if (fclose(fp) != 0 || failed || rename(tmp, metrics_path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* 写指标文件，失败时只警告一次 */
+void metrics_update(const stress_worker_t *w, int n, double elapsed, uint64_t peak_kb) {
+    static int warned = 0;
+    if (metrics_write(w, n, elapsed, peak_kb) != 0 && !warned) {
+        fprintf(stderr, "警告: 无法写入指标文件 %s\n", metrics_path);
+        warned = 1;
+    }
+}
+
+/* 单次和持续计算时的仪表盘线程 */
+void *tui_main(void *arg) {
+    (void)arg;
+    char title[128];
+    tui_t *t = malloc(sizeof(tui_t));
+    if (!t) return NULL;
+    tui_init(t, run_worker, 1);
+    struct timespec interval = { 0, TUI_REFRESH_MS * 1000000L };
+    while (__atomic_load_n(&run_stats_running, __ATOMIC_ACQUIRE)) {
+        snprintf(title, sizeof(title), "SuperPi 持续计算 %s  当前 %llu 位  %d 线程",
+                 constants[constant_id].name,
+                 (unsigned long long)__atomic_load_n(&run_worker->digits, __ATOMIC_RELAXED), num_threads);
+        tui_render(t, title, run_worker, 1, resident_kb());
+        nanosleep(&interval, NULL);
+    }
+    tui_finish();
+    free(t);
+    return NULL;
+}
+
+/* 单次和持续计算时每隔metrics_interval秒写一次指标文件 */
+void *metrics_main(void *arg) {
+    (void)arg;
+    struct timespec slice = { 0, 100 * 1000000L };
+    double last = wall_time();
+    while (__atomic_load_n(&run_stats_running, __ATOMIC_ACQUIRE)) {
+        nanosleep(&slice, NULL);
+        if (wall_time() - last >= metrics_interval) {
+            last = wall_time();
+            metrics_update(run_worker, 1, last - run_stats_origin, peak_rss_kb());
+        }
+    }
+    return NULL;
+}
+
+/* 单次和持续计算时定期调整run_tasks的线程数上限 */
+void *background_main(void *arg) {
+    (void)arg;
+    struct timespec slice = { 0, 100 * 1000000L };
+    double last = wall_time();
+    while (__atomic_load_n(&run_stats_running, __ATOMIC_ACQUIRE)) {
+        nanosleep(&slice, NULL);
+        double now = wall_time();
+        if (now - last < BACKGROUND_POLL_MS / 1000.0) continue;
+        int limit = __atomic_load_n(&thread_limit, __ATOMIC_RELAXED);
+        background_thread_seconds += limit * (now - last);
+        background_thread_wall += now - last;
+        last = now;
+        __atomic_store_n(&thread_limit, background_adjust(limit, num_threads), __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/* 持续计算的看门狗：有线程停住时报告、列出所有线程的状态，然后以EXIT_STALLED退出 */
+void *watchdog_main(void *arg) {
+    (void)arg;
+    struct timespec slice = { 0, WATCHDOG_POLL_MS * 1000000L };
+    while (__atomic_load_n(&run_stats_running, __ATOMIC_ACQUIRE)) {
+        nanosleep(&slice, NULL);
+        uint64_t now = monotonic_ns();
+        for (int i = 0; i < heartbeat_count; i++) {
+            double idle = watchdog_overdue(&heartbeats[i], now);
+            if (idle == 0) continue;
+            if (run_worker && tui_mode) {  // 先停下仪表盘，恢复光标
+                __atomic_store_n(&run_stats_running, 0, __ATOMIC_RELEASE);
+                pthread_join(tui_thread, NULL);
+            }
+            char label[32];
+            snprintf(label, sizeof(label), "线程 %d", i);
+            watchdog_report(label, &heartbeats[i], idle);
+            fprintf(stderr, "各线程的状态:\n");
+            for (int j = 0; j < heartbeat_count; j++) {
+                snprintf(label, sizeof(label), "线程 %d", j);
+                watchdog_dump_one(label, &heartbeats[j], (int)getpid(), now);
+            }
+            fflush(stdout);  // _exit不刷新缓冲区，重定向到文件时前面几轮的输出还在里面
+            _exit(EXIT_STALLED);  // 停住的线程无法正常结束，直接退出
+        }
+    }
+    return NULL;
+}
+
+/*
+ * 单次和持续计算：需要时分配计数器，启动仪表盘（--tui）和指标文件（--metrics-file）线程；
+ * watchdog非0时（持续计算）给每个调度器线程分配心跳并启动看门狗线程，
+ * 后台模式再启动按CPU压力调整线程数的线程
+ */
+void run_stats_start(int watchdog) {
+    run_stats_origin = wall_time();
+    run_stats_running = 1;
+    if (background_mode && pthread_create(&background_thread, NULL, background_main, NULL) != 0) {
+        background_mode = 0;
+    }
+    if (watchdog && watchdog_seconds > 0) {
+        heartbeats = calloc((size_t)num_threads, sizeof(heartbeat_t));
+        heartbeat_count = heartbeats ? num_threads : 0;
+        if (heartbeats && pthread_create(&watchdog_thread, NULL, watchdog_main, NULL) != 0) {
+            free(heartbeats);
+            heartbeats = NULL;
+            heartbeat_count = 0;
+        }
+    }
+    if (!tui_mode && !metrics_path) return;
+    run_worker = calloc(1, sizeof(stress_worker_t));
+    if (!run_worker) return;
+    run_worker->cpu = -1;
+    if (tui_mode) {
+        quiet = 1;  // 计算过程中的输出会打乱仪表盘
+        if (pthread_create(&tui_thread, NULL, tui_main, NULL) != 0) {
+            tui_mode = 0;
+            quiet = 0;
+        }
+    }
+    if (metrics_path && pthread_create(&metrics_thread, NULL, metrics_main, NULL) != 0) {
+        metrics_path = NULL;
+    }
+}
+
+/* 一轮开始（finished为0）或结束，更新计数器 */
+void run_stats_round(uint64_t digits, int finished, uint64_t bad, int checked, double seconds) {
+    if (finished && !bad) background_digits += digits;
+    if (heartbeats) {
+        if (finished) {
+            heartbeat_state(HEARTBEAT_IDLE);  // 保存结果和轮间休眠不算
+        } else {
+            heartbeat_round(digits);
+        }
+    }
+    if (!run_worker) return;
+    if (finished) {
+        worker_finish_round(run_worker, digits, bad, checked, seconds);
+    } else {
+        __atomic_store_n(&run_worker->digits, digits, __ATOMIC_RELAXED);
+        __atomic_store_n(&run_worker->state, WORKER_COMPUTE, __ATOMIC_RELAXED);
+    }
+}
+
+void run_stats_stop(void) {
+    __atomic_store_n(&run_stats_running, 0, __ATOMIC_RELEASE);
+    if (background_mode) pthread_join(background_thread, NULL);
+    if (heartbeats) {
+        pthread_join(watchdog_thread, NULL);
+        free(heartbeats);
+        heartbeats = NULL;
+        heartbeat_count = 0;
+    }
+    if (!run_worker) return;
+    if (tui_mode) pthread_join(tui_thread, NULL);
+    if (metrics_path) {
+        pthread_join(metrics_thread, NULL);
+        metrics_update(run_worker, 1, wall_time() - run_stats_origin, peak_rss_kb());
+    }
+    free(run_worker);
+    run_worker = NULL;
+}
+
+/* 压力测试的子进程：固定在一个CPU上单线程反复计算，与参考结果对比 */
+void stress_child(stress_worker_t *w, uint64_t digits, const char *ref) {
+    signal(SIGINT, SIG_IGN);  // 由父进程统一停止
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(w->cpu, &one);
+    sched_setaffinity(0, sizeof(one), &one);
+    num_threads = 1;
+    quiet = 1;
+    progress_fd = -1;
+    show_eta = 0;
+    heartbeats = &w->hb;
+    heartbeat_count = 1;
+    throttle_armed = 0;  // 定时器不随fork继承
+    throttle_begin();
+    
+    for (;;) {
+        heartbeat_round(digits);
+        __atomic_store_n(&w->state, WORKER_COMPUTE, __ATOMIC_RELAXED);
+        double start = wall_time();
+        char *got = NULL;
+        uint64_t ok = calculate_constant_digits(digits, &got);
+        __atomic_store_n(&w->state, WORKER_VERIFY, __ATOMIC_RELAXED);
+        uint64_t bad = ok == 0 || !got ? 1 : golden_mismatch(got, ref, digits);
+        free(got);
+        worker_finish_round(w, digits, bad, 1, wall_time() - start);
+    }
+}
+
+/*
+ * 逐行输出各子进程新完成的轮次；seen记录上次看到的轮数和出错数（每个子进程两个）
+ * 两次检查之间可能完成了好几轮，只报告最近一轮，有新的出错时报告出错
+ */
+void stress_report_rounds(stress_worker_t *w, int n, uint64_t *seen) {
+    for (int i = 0; i < n; i++) {
+        uint64_t rounds = __atomic_load_n(&w[i].rounds, __ATOMIC_ACQUIRE);
+        if (rounds == seen[2 * i]) continue;
+        uint64_t errors = __atomic_load_n(&w[i].errors, __ATOMIC_RELAXED);
+        seen[2 * i] = rounds;
+        if (errors != seen[2 * i + 1]) {
+            seen[2 * i + 1] = errors;
+            printf("CPU %3d 第 %llu 轮: 出错！第 %llu 位起与参考结果不符（累计 %llu 轮出错）\n", w[i].cpu,
+                   (unsigned long long)rounds, (unsigned long long)w[i].first_bad,
+                   (unsigned long long)errors);
+        } else {
+            printf("CPU %3d 第 %llu 轮: 通过，%.2f 秒\n", w[i].cpu, (unsigned long long)rounds,
+                   w[i].round_ns / 1e9);
+        }
+    }
+    fflush(stdout);
+}
+
+/* 所有子进程的常驻内存之和（KB） */
+uint64_t stress_rss_kb(const stress_worker_t *w, int n) {
+    uint64_t total = resident_kb();
+    for (int i = 0; i < n; i++) {
+        char path[64];
+        unsigned long size, resident;
+        snprintf(path, sizeof(path), "/proc/%d/statm", (int)w[i].pid);
+        FILE *fp = fopen(path, "r");
+        if (!fp) continue;
+        if (fscanf(fp, "%lu %lu", &size, &resident) == 2) {
+            total += (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE) / 1024;
+        }
+        fclose(fp);
+    }
+    return total;
+}
+
+/*
+ * 后台模式：只让前active个子进程运行，其余的用SIGSTOP暂停。parked是父进程自己的记录，
+ * 子进程的state可能在SIGSTOP生效之前被它自己改掉。恢复时重置心跳，暂停的时间不算停住
+ */
+void stress_park(stress_worker_t *w, int n, int active, char *parked) {
+    for (int i = 0; i < n; i++) {
+        if (w[i].pid <= 0 || w[i].state == WORKER_EXITED) continue;
+        if (i >= active && !parked[i]) {
+            kill(w[i].pid, SIGSTOP);
+            parked[i] = 1;
+            __atomic_store_n(&w[i].state, WORKER_PARKED, __ATOMIC_RELAXED);
+        } else if (i < active && parked[i]) {
+            __atomic_store_n(&w[i].hb.beat_ns, monotonic_ns(), __ATOMIC_RELEASE);
+            __atomic_store_n(&w[i].state, WORKER_COMPUTE, __ATOMIC_RELAXED);
+            parked[i] = 0;
+            kill(w[i].pid, SIGCONT);
+        }
+    }
+}
+
+/* 各子进程峰值之和加上父进程（参考结果）的峰值，所有进程同时达到峰值时的上限 */
+uint64_t stress_peak_kb(const stress_worker_t *w, int n) {
+    uint64_t kb = peak_rss_kb();
+    for (int i = 0; i < n; i++) kb += __atomic_load_n(&w[i].peak_rss_kb, __ATOMIC_RELAXED);
+    return kb;
+}
+
+/*
+ * 压力测试：先用全部线程算出参考结果，再在前num_threads个可用CPU上
+ * 各起一个子进程反复计算并对比，直到Ctrl+C或运行满seconds秒（0表示不限）。
+ * 有任何一轮出错或子进程异常退出时返回1
+ */
+int stress_run(uint64_t digits, double seconds) {
+    printf("SuperPi - 压力测试：%s %llu 位，先用 %d 个线程计算参考结果...\n",
+           constants[constant_id].name, (unsigned long long)digits, num_threads);
+    char *ref = NULL;
+    double start = wall_time();
+    if (calculate_constant_digits(digits, &ref) == 0) {
+        fprintf(stderr, "错误: 参考结果计算失败\n");
+        free(ref);
+        return 1;
+    }
+    printf("参考结果用时 %.2f 秒\n", wall_time() - start);
+    /* 子进程单线程算一轮最多要参考结果的num_threads倍时间，第一次心跳之前用它作阈值 */
+    watchdog_first = WATCHDOG_FACTOR * (wall_time() - start) * num_threads;
+    
+    int cpus[MAX_THREADS];
+    int n = allowed_cpus(cpus, num_threads);
+    stress_worker_t *w = mmap(NULL, (size_t)n * sizeof(stress_worker_t), PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    uint64_t *seen = calloc(2 * (size_t)n, sizeof(uint64_t));
+    char *parked = calloc((size_t)n, 1);
+    if (w == MAP_FAILED || !seen || !parked) {
+        fprintf(stderr, "错误: 内存不足\n");
+        free(ref);
+        free(seen);
+        free(parked);
+        return 1;
+    }
+    memset(w, 0, (size_t)n * sizeof(stress_worker_t));
+    
+    printf("在 %d 个CPU上各运行一个计算进程，按Ctrl+C停止\n\n", n);
+    fflush(stdout);  // 子进程会继承未输出的缓冲
+    int started = 0;
+    for (int i = 0; i < n; i++) {
+        w[i].cpu = cpus[i];
+        w[i].digits = digits;
+        pid_t pid = fork();
+        if (pid == 0) {
+            stress_child(&w[i], digits, ref);
+            _exit(0);
+        }
+        if (pid < 0) {
+            fprintf(stderr, "错误: 无法创建第 %d 个计算进程\n", i + 1);
+            w[i].state = WORKER_EXITED;
+            continue;
+        }
+        w[i].pid = pid;
+        started++;
+    }
+    
+    tui_t *t = NULL;
+    if (tui_mode) {
+        t = malloc(sizeof(tui_t));
+        if (t) tui_init(t, w, n);
+    }
+    char title[128];
+    snprintf(title, sizeof(title), "SuperPi 压力测试 %s  %llu 位 × %d 个CPU", constants[constant_id].name,
+             (unsigned long long)digits, n);
+    start = wall_time();
+    double metrics_last = start;
+    double park_last = start, active_seconds = 0;
+    int stalled = -1, active = n;
+    struct timespec interval = { 0, (t ? TUI_REFRESH_MS : STRESS_POLL_MS) * 1000000L };
+    while (keep_running && started > 0 && (seconds <= 0 || wall_time() - start < seconds)) {
+        nanosleep(&interval, NULL);
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (int i = 0; i < n; i++) {
+                if (w[i].pid != pid) continue;
+                w[i].state = WORKER_EXITED;
+                started--;
+                if (!t) {
+                    printf("CPU %3d 的计算进程异常退出（%s %d）\n", w[i].cpu,
+                           WIFSIGNALED(status) ? "信号" : "退出码",
+                           WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+                }
+            }
+        }
+        if (t) {
+            tui_render(t, title, w, n, stress_rss_kb(w, n));
+        } else {
+            stress_report_rounds(w, n, seen);
+        }
+        if (metrics_path && wall_time() - metrics_last >= metrics_interval) {
+            metrics_last = wall_time();
+            metrics_update(w, n, metrics_last - start, stress_peak_kb(w, n));
+        }
+        
+        if (background_mode && wall_time() - park_last >= BACKGROUND_POLL_MS / 1000.0) {
+            active_seconds += active * (wall_time() - park_last);
+            park_last = wall_time();
+            active = background_adjust(active, n);
+            stress_park(w, n, active, parked);
+        }
+        
+        /* 看门狗：子进程在父进程的这个循环里检查，在子进程结束之前列出各进程的状态 */
+        uint64_t now = monotonic_ns();
+        for (int i = 0; i < n && stalled < 0; i++) {
+            double idle = w[i].state == WORKER_EXITED || parked[i] ? 0 : watchdog_overdue(&w[i].hb, now);
+            if (idle == 0) continue;
+            if (t) {
+                tui_finish();
+                free(t);
+                t = NULL;
+            }
+            char label[32];
+            snprintf(label, sizeof(label), "计算进程 %d", (int)w[i].pid);
+            watchdog_report(label, &w[i].hb, idle);
+            fprintf(stderr, "各计算进程的状态:\n");
+            for (int j = 0; j < n; j++) {
+                snprintf(label, sizeof(label), "进程 %d", (int)w[j].pid);
+                watchdog_dump_one(label, &w[j].hb, (int)w[j].pid, now);
+            }
+            stalled = i;
+        }
+        if (stalled >= 0) break;
+    }
+    
+    for (int i = 0; i < n; i++) {
+        if (i == stalled) {
+            /* 停住的进程可能处于不可中断的等待，最多等一秒 */
+            kill(w[i].pid, SIGKILL);
+            struct timespec slice = { 0, STRESS_POLL_MS * 1000000L };
+            for (int k = 0; k < 1000 / STRESS_POLL_MS && waitpid(w[i].pid, NULL, WNOHANG) == 0; k++) {
+                nanosleep(&slice, NULL);
+            }
+        } else if (w[i].pid > 0 && w[i].state != WORKER_EXITED) {
+            kill(w[i].pid, SIGTERM);
+            if (parked[i]) kill(w[i].pid, SIGCONT);  // 暂停中的进程要继续运行才会处理SIGTERM
+            waitpid(w[i].pid, NULL, 0);
+        }
+    }
+    if (t) {
+        tui_finish();
+        free(t);
+    }
+    if (metrics_path) metrics_update(w, n, wall_time() - start, stress_peak_kb(w, n));
+    
+    uint64_t rounds = 0, errors = 0;
+    int exited = 0;
+    for (int i = 0; i < n; i++) {
+        rounds += w[i].rounds;
+        errors += w[i].errors;
+        if (w[i].state == WORKER_EXITED) exited++;
+        if (w[i].errors) {
+            printf("CPU %3d: %llu 轮中 %llu 轮出错\n", w[i].cpu, (unsigned long long)w[i].rounds,
+                   (unsigned long long)w[i].errors);
+        }
+    }
+    printf("压力测试结束：%d 个CPU，运行 %.1f 秒，共 %llu 轮，%llu 轮出错，%d 个进程异常退出%s\n",
+           n, wall_time() - start, (unsigned long long)rounds, (unsigned long long)errors, exited,
+           stalled >= 0 ? "，1 个进程停住" : "");
+    if (background_mode) {
+        uint64_t digits_done = 0;
+        for (int i = 0; i < n; i++) digits_done += w[i].digits_done;
+        struct rusage ru;
+        double cpu = getrusage(RUSAGE_CHILDREN, &ru) == 0
+                   ? ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6 : 0;
+        background_report(digits_done, wall_time() - start, cpu, park_last > start ? active_seconds / (park_last - start) : n);
+    }
+    munmap(w, (size_t)n * sizeof(stress_worker_t));
+    free(seen);
+    free(parked);
+    free(ref);
+    if (stalled >= 0) return EXIT_STALLED;
+    return errors || exited ? 1 : 0;
+}
+
+/* ===== 平方根与黄金分割比 ===== */
+
+/*
+ * 精度阶梯的下限。阶梯按 p/2+32 减半（多留32位抵消每步的舍入），
+ * 它的不动点是64，所以下限必须明显大于64，否则要到步数上限才停，
+ * 前面几十步都在64位上空转；96位以下一步就能从53位初值到位。
+ */
+#define RSQRT_LADDER_MIN 96
+
+/*
+ * 用倍增精度的牛顿迭代求 r = 1/sqrt(n)：
+ *   x' = x + x * (1 - n*x^2) / 2
+ * 每次迭代正确位数翻倍，所以第i步只需在最终精度的 1/2^i 上进行，
+ * 总开销只相当于几次全精度乘法。全程只有乘法，不用除法和mpf_sqrt。
+ */
+void mpf_rsqrt_ui(mpf_t r, unsigned long n) {
+    mp_bitcnt_t target = mpf_get_prec(r);
+    
+    /* 从目标精度反复减半，记下每一步的精度；每步至少减掉 (p-64)/2 位，64步足够 */
+    mp_bitcnt_t prec[64];
+    int steps = 0;
+    for (mp_bitcnt_t p = target; p > RSQRT_LADDER_MIN && steps < 64; p = p / 2 + 32) {
+        prec[steps++] = p;
+    }
+    
+    double total = 0;
+    for (int i = 0; i < steps; i++) total += ETA_NEWTON_MULS * mul_work((double)prec[i]);
+    
+    mpf_t t, u;
+    mpf_init2(t, target);
+    mpf_init2(u, target);
+    mpf_set_d(r, 1.0 / sqrt((double)n));  // 53位初值
+    
+    progress_begin_run();
+    for (int i = steps - 1; i >= 0; i--) {
+        mpf_set_prec_raw(t, prec[i]);
+        mpf_set_prec_raw(u, prec[i]);
+        mpf_mul(t, r, r);
+        mpf_mul_ui(t, t, n);
+        mpf_ui_sub(t, 1, t);        // 1 - n*x^2，只剩约一半有效位
+        mpf_mul(u, t, r);
+        mpf_div_2exp(u, u, 1);
+        mpf_add(r, r, u);
+        progress_post(PROGRESS_STEP, PHASE_NEWTON, steps - i, steps, (uint64_t)(prec[i] * log10(2.0)),
+                      ETA_NEWTON_MULS * mul_work((double)prec[i]), total);
+    }
+    
+    mpf_set_prec_raw(t, target);
+    mpf_set_prec_raw(u, target);
+    mpf_clear(t);
+    mpf_clear(u);
+}
+
+/*
+ * 计算sqrt(n) = n * (1/sqrt(n))，误差半径由残差直接给出：
+ * |x - sqrt(n)| = |x^2 - n| / (x + sqrt(n)) < |x^2 - n| / x，
+ * x^2 在两倍多的精度上算，乘法和减法都是精确的
+ */
+void compute_sqrt_ui(mpf_t x, unsigned long n) {
+    mpf_rsqrt_ui(x, n);
+    mpf_mul_ui(x, x, n);
+    
+    mpf_t check;
+    mpf_init2(check, 2 * mpf_get_prec(x) + 4 * GMP_NUMB_BITS);
+    mpf_mul(check, x, x);
+    mpf_sub_ui(check, check, n);
+    radius_log2 = ball_mag(check) - ball_low(x);
+    if (quiet) {  // 基准测试时不打印
+        mpf_clear(check);
+        return;
+    }
+    if (mpf_sgn(check) == 0) {
+        printf("平方校验: x^2 - %lu = 0\n", n);
+    } else {
+        long exp;
+        mpf_get_d_2exp(&exp, check);
+        printf("平方校验: |x^2 - %lu| < 2^%ld\n", n, exp);
+    }
+    mpf_clear(check);
+}
+
+void compute_sqrt2(mpf_t x, uint64_t digits) {
+    (void)digits;
+    compute_sqrt_ui(x, 2);
+}
+
+void compute_sqrt3(mpf_t x, uint64_t digits) {
+    (void)digits;
+    compute_sqrt_ui(x, 3);
+}
+
+/* φ = (1 + sqrt(5)) / 2 */
+void compute_phi(mpf_t x, uint64_t digits) {
+    (void)digits;
+    compute_sqrt_ui(x, 5);
+    mpf_add_ui(x, x, 1);
+    radius_log2 = ball_round(radius_log2, x);
+    mpf_div_2exp(x, x, 1);
+    radius_log2 = ball_round(radius_log2 - 1, x);
+}
+
+/* ===== 对数常数 ===== */
+
+/*
+ * arccoth(x) = Σ 1/((2k+1) x^(2k+1))
+ * 取 p(k) = 2k-1, q(k) = (2k+1)x^2, a(k) = 1，则
+ *   arccoth(x) = (1 + T/Q) / x
+ * P1与Q2共享大量奇数因子，可以做公因子约简
+ */
+void acoth_leaf(const bs_series_t *s, bs_node_t *node, uint64_t k, int track) {
+    mpz_set_ui(node->p, 2 * k - 1);
+    mpz_set_ui(node->q, 2 * k + 1);
+    mpz_mul_ui(node->q, node->q, s->x * s->x);
+    mpz_set(node->t, node->p);
+    
+    if (track) {
+        fac_mul_ui(&node->fp, 2 * k - 1, 1);
+        fac_mul_ui(&node->fq, 2 * k + 1, 1);
+        fac_mul_ui(&node->fq, s->x, 2);
+    }
+}
+
+double acoth_bits(const bs_series_t *s, uint64_t a, uint64_t b) {
+    return sum_log2_linear(a, b, 2, 1) + (double)(b - a) * 2.0 * log2((double)s->x);
+}
+
+double acoth_term_bits(const bs_series_t *s, double k) {
+    return log2(2 * k + 1) + 2.0 * log2((double)s->x);
+}
+
+/* 1 + T/Q 的第k项是 1/((2k+1) x^(2k))，余项 < 2 x^(-2n) */
+double acoth_tail(const bs_series_t *s, uint64_t n) {
+    return 1.0 - 2.0 * n * log2((double)s->x);
+}
+
+/*
+ * r = arccoth(x)，精度取r的精度
+ * parallel非0时走并行调度并输出统计，否则串行求值（用于小精度的内部常数）
+ * 返回值：误差半径（log2），截断误差加上收尾运算的舍入误差
+ */
+double mpf_acoth_ui(mpf_t r, unsigned long x, int parallel) {
+    bs_series_t series = { acoth_leaf, acoth_bits, acoth_term_bits, acoth_tail, 1, 2, x };
+    /* 余项除以x之后小于 2^-精度 即可 */
+    uint64_t terms = bs_terms(&series, log2((double)x) - (double)mpf_get_prec(r));
+    
+    bs_node_t root;
+    bs_node_init(&root);
+    if (parallel) {
+        bs_evaluate(&series, &root, 1, terms);
+    } else {
+        bs_series(&series, &root, 1, terms, 0, 0, 0);  // 没有准备筛表，不约简
+    }
+    
+    double radius = mpf_set_ratio(r, root.t, root.q);
+    mpf_add_ui(r, r, 1);
+    radius = log2_sum(ball_round(radius, r), series.tail(&series, terms));
+    mpf_div_ui(r, r, x);
+    
+    bs_node_clear(&root);
+    return ball_round(radius - log2((double)x), r);
+}
+
+/* 类Machin公式中的一项：coef * arccoth(x) */
+typedef struct {
+    long coef;
+    unsigned long x;
+} machin_term_t;
+
+/* ln2 = 18 arccoth(26) - 2 arccoth(4801) + 8 arccoth(8749) */
+const machin_term_t log2_machin[] = { {18, 26}, {-2, 4801}, {8, 8749} };
+/* ln10 = 46 arccoth(31) + 34 arccoth(49) + 20 arccoth(161) */
+const machin_term_t log10_machin[] = { {46, 31}, {34, 49}, {20, 161} };
+
+/* r = Σ coef * arccoth(x)，每一项内部用并行二分拆分；返回误差半径（log2） */
+double machin_sum(mpf_t r, const machin_term_t *terms, int count, int parallel) {
+    mpf_t a;
+    mpf_init2(a, mpf_get_prec(r));
+    mpf_set_ui(r, 0);
+    double radius = -INFINITY;
+    for (int i = 0; i < count; i++) {
+        double ra = mpf_acoth_ui(a, terms[i].x, parallel);
+        mpf_mul_ui(a, a, (unsigned long)labs(terms[i].coef));
+        ra = ball_round(ra + log2((double)labs(terms[i].coef)), a);
+        if (terms[i].coef >= 0) {
+            mpf_add(r, r, a);
+        } else {
+            mpf_sub(r, r, a);
+        }
+        radius = ball_round(log2_sum(radius, ra), r);
+    }
+    mpf_clear(a);
+    return radius;
+}
+
+void compute_log2(mpf_t x, uint64_t digits) {
+    (void)digits;
+    radius_log2 = machin_sum(x, log2_machin, 3, 1);
+}
+
+void compute_log10(mpf_t x, uint64_t digits) {
+    (void)digits;
+    radius_log2 = machin_sum(x, log10_machin, 3, 1);
+}
+
+/* 192位精度的 log2(10) = ln10/ln2，首次使用时求出 */
+mpf_t log2_10;
+pthread_once_t log2_10_once = PTHREAD_ONCE_INIT;
+
+void log2_10_init(void) {
+    mpf_t ln2;
+    mpf_init2(log2_10, 192);
+    mpf_init2(ln2, 192);
+    machin_sum(log2_10, log10_machin, 3, 0);
+    machin_sum(ln2, log2_machin, 3, 0);
+    mpf_div(log2_10, log2_10, ln2);
+    mpf_clear(ln2);
+}
+
+/*
+ * 十进制位数折算成二进制位数：ceil(digits * ln10/ln2)
+ * 对任何64位的位数，192位的 log2(10) 都足以给出准确的向上取整，
+ * 不再用3.322近似（它在大位数时会少算）。
+ */
+mp_bitcnt_t digits_to_bits(uint64_t digits) {
+    pthread_once(&log2_10_once, log2_10_init);
+    
+    mpf_t bits;
+    mpf_init2(bits, 256);
+    mpf_mul_ui(bits, log2_10, digits);
+    mpf_ceil(bits, bits);
+    mp_bitcnt_t result = mpf_get_ui(bits);
+    mpf_clear(bits);
+    return result;
+}
+
+/* 任意进制的位数折算成二进制位数 */
+mp_bitcnt_t base_digits_to_bits(uint64_t digits, int base) {
+    if (base == 10) return digits_to_bits(digits);
+    if ((base & (base - 1)) == 0) {
+        mp_bitcnt_t bits = 0;
+        while ((1 << bits) < base) bits++;
+        return digits * bits;  // 2的幂进制没有折算误差
+    }
+    return (mp_bitcnt_t)ceill(digits * log2l((long double)base)) + 1;
+}
+
+/* ===== 保护位与误差半径 ===== */
+
+/*
+ * 保护位数的误差分析。GMP的mpf运算结果截断到工作精度，每次舍入的相对误差
+ * 不超过 2^-精度；整数部分的二进制位数另算。于是舍入误差不超过
+ *   舍入次数 × 放大倍数 × 2^-精度
+ * 这个模型只用来选精度。输出哪些位由各计算函数实际跟踪的误差半径（radius_log2）决定，
+ * 模型估计不足时验证失败、自动提高精度重算，而不是输出错误的位。
+ *   Gauss-Legendre：每次迭代8次舍入，AGM对a、b的误差不放大，
+ *                   t 里 p*(a'-a)^2 的误差随 (a'-a) 二次缩小，按每次迭代放大4倍算
+ *   二分拆分（π的Chudnovsky、e、ζ(3)、Catalan）：整数运算是精确的，只有最后几步舍入
+ *   牛顿迭代：自校正，前面各步的误差被最后一步平方掉，只剩最后一步和收尾的舍入
+ *   类Machin：每项一次二分拆分加几次舍入，放大倍数按系数绝对值之和算
+ */
+#define GUARD_MARGIN_BITS 64    // 超出误差上界的余量，转换时末位附近的进位也靠它
+#define GUARD_GL_OPS 8          // 一次Gauss-Legendre迭代的舍入次数
+#define GUARD_GL_GAIN 4         // 每次迭代的误差放大倍数
+#define GUARD_FINISH_OPS 8      // 求值末尾的除法、开方、整数转浮点等
+
+double rounding_log2(uint64_t digits) {
+    double ops = GUARD_FINISH_OPS, gain = 1;
+    switch (constant_id) {
+    case CONST_PI:
+        if (pi_algorithm != ALGO_CHUDNOVSKY) {
+            /* 迭代次数与 compute_pi_gauss_legendre 一致 */
+            unsigned long iterations = (unsigned long)(log2((double)digits) + 2);
+            ops += (double)GUARD_GL_OPS * iterations;
+            gain = pow(GUARD_GL_GAIN, iterations);
+        }
+        break;
+    case CONST_LOG2:
+    case CONST_LOG10:
+        ops *= 3;      // 三项arccoth
+        gain = 100;    // Σ|系数|：ln2 为28，ln10 为100
+        break;
+    default:
+        break;
+    }
+    return log2(ops * gain);
+}
+
+mp_bitcnt_t guard_bits(uint64_t digits) {
+    return (mp_bitcnt_t)ceil(rounding_log2(digits)) + GUARD_INT_BITS + GUARD_MARGIN_BITS;
+}
+
+/* log2(2^a + 2^b)，误差半径太小，直接相加会下溢 */
+double log2_sum(double a, double b) {
+    double hi = a > b ? a : b, lo = a > b ? b : a;
+    if (hi == -INFINITY) return hi;
+    return hi + log2(1.0 + exp2(lo - hi));
+}
+
+/*
+ * 球算术（中点 + 半径）：mpf的每次运算等于精确结果截断到目标精度，
+ * 截断误差小于结果最高位以下第“精度”位的一个单位。半径都用log2表示，
+ * 先按运算规则由操作数的半径求出传递误差（运算之前调用，操作数可能被结果覆盖），
+ * 运算之后再用ball_round加上这次截断。
+ */
+#define BALL_SLACK 1e-6     // log2|x| 用双精度估计，上下界各放宽这么多
+
+double ball_mag(mpf_t x) {
+    if (mpf_sgn(x) == 0) return -INFINITY;
+    long e;
+    double d = mpf_get_d_2exp(&e, x);   // 向零截断：|d| * 2^e <= |x| < (|d| + 2^-53) * 2^e
+    return (double)e + log2(fabs(d) + 0x1p-52) + BALL_SLACK;
+}
+
+double ball_low(mpf_t x) {
+    if (mpf_sgn(x) == 0) return -INFINITY;
+    long e;
+    double d = mpf_get_d_2exp(&e, x);
+    return (double)e + log2(fabs(d)) - BALL_SLACK;
+}
+
+double ball_round(double r, mpf_t x) {
+    return log2_sum(r, ball_mag(x) - (double)mpf_get_prec(x) + 1);
+}
+
+/* |a'b' - ab| <= |a| rb + |b| ra + ra rb */
+double ball_mul(mpf_t a, double ra, mpf_t b, double rb) {
+    return log2_sum(log2_sum(ball_mag(a) + rb, ball_mag(b) + ra), ra + rb);
+}
+
+/* |a'/b' - a/b| <= (ra + |a/b| rb) / (|b| - rb)，要求 rb 远小于 |b| */
+double ball_div(mpf_t a, double ra, mpf_t b, double rb) {
+    double low = ball_low(b);
+    if (rb >= low - 1) return INFINITY;
+    return log2_sum(ra, ball_mag(a) - low + rb) - low - log2(1 - exp2(rb - low));
+}
+
+/* |sqrt(a') - sqrt(a)| <= ra / (2 sqrt(a - ra)) */
+double ball_sqrt(mpf_t a, double ra) {
+    double low = ball_low(a);
+    if (ra >= low - 1) return INFINITY;
+    return ra - 1 - 0.5 * (low + log2(1 - exp2(ra - low)));
+}
+
+/* 二分拆分的收尾 x = t/q：两次整数转换和一次除法的截断，返回误差半径 */
+double mpf_set_ratio(mpf_t x, mpz_t t, mpz_t q) {
+    mpf_t den;
+    mpf_init2(den, mpf_get_prec(x));
+    mpf_set_z(x, t);
+    double r = ball_round(-INFINITY, x);
+    mpf_set_z(den, q);
+    r = ball_div(x, r, den, ball_round(-INFINITY, den));
+    mpf_div(x, x, den);
+    mpf_clear(den);
+    return ball_round(r, x);
+}
+
+/*
+ * s与真值之差小于第known位的一个单位时，前n位可信的条件是
+ * 第n+1到第known位既不全是0，也不全是最大数字（十进制的9）：
+ * 否则真值可能在进位或借位的另一侧（如 ...4999|9 与 ...5000|0）。
+ * 返回不超过digits的最大可信位数。
+ */
+uint64_t certify_prefix(const char *s, uint64_t digits, uint64_t known, int base) {
+    char top = digit_chars[base - 1];
+    int nonzero = 0, nontop = 0;
+    for (uint64_t n = known; n > 0;) {
+        n--;
+        if (s[n] != '0') nonzero = 1;
+        if (s[n] != top) nontop = 1;
+        if (nonzero && nontop) return n < digits ? n : digits;
+    }
+    return 0;
+}
+
+/* ===== ζ(3) 与 Catalan 常数 ===== */
+
+/*
+ * 这两个级数每位小数需要的项数比Chudnovsky多得多（约3位/项和0.9位/项），
+ * 而且各层乘法大小均匀，适合作为长时间的乘法密集型压力负载。
+ *
+ * Amdeberhan-Zeilberger：
+ *   ζ(3) = 1/64 Σ (-1)^k (k!)^10 (205k^2 + 250k + 77) / ((2k+1)!)^5
+ * 相邻两项之比 p(k)/q(k) = -k^5 / (32 (2k+1)^5)，a(k) = 205k^2 + 250k + 77
+ */
+void zeta3_leaf(const bs_series_t *s, bs_node_t *node, uint64_t k, int track) {
+    (void)s;
+    mpz_ui_pow_ui(node->p, k, 5);
+    mpz_neg(node->p, node->p);
+    mpz_ui_pow_ui(node->q, 2 * k + 1, 5);
+    mpz_mul_2exp(node->q, node->q, 5);
+    mpz_mul_ui(node->t, node->p, 205 * k * k + 250 * k + 77);
+    
+    if (track) {
+        fac_mul_ui(&node->fp, k, 5);
+        fac_mul_ui(&node->fq, 2, 5);
+        fac_mul_ui(&node->fq, 2 * k + 1, 5);
+    }
+}
+
+double zeta3_bits(const bs_series_t *s, uint64_t a, uint64_t b) {
+    (void)s;
+    return 5.0 * sum_log2_linear(a, b, 2, 1) + 5.0 * (double)(b - a);
+}
+
+double zeta3_term_bits(const bs_series_t *s, double k) {
+    (void)s;
+    return 5.0 * log2(2 * k + 1) + 5.0;
+}
+
+/* 相邻两项之比不超过 1/1024，第k项不超过 (205k^2 + 250k + 77) 1024^(-k)，交错递减 */
+double zeta3_tail(const bs_series_t *s, uint64_t n) {
+    (void)s;
+    return log2(205.0 * n * n + 250.0 * n + 77) - 10.0 * n;
+}
+
+const bs_series_t zeta3_series = { zeta3_leaf, zeta3_bits, zeta3_term_bits, zeta3_tail, 1, 2, 0 };
+
+void compute_zeta3(mpf_t x, uint64_t digits) {
+    (void)digits;
+    uint64_t terms = bs_terms(&zeta3_series, 6.0 - (double)mpf_get_prec(x));  // 每项约 1/1024
+    
+    bs_node_t root;
+    bs_node_init(&root);
+    bs_evaluate(&zeta3_series, &root, 1, terms);
+    
+    /* ζ(3) = (77 + T/Q) / 64 */
+    double r = mpf_set_ratio(x, root.t, root.q);
+    mpf_add_ui(x, x, 77);
+    r = log2_sum(ball_round(r, x), zeta3_series.tail(&zeta3_series, terms));
+    mpf_div_2exp(x, x, 6);
+    radius_log2 = ball_round(r - 6, x);
+    
+    bs_node_clear(&root);
+}
+
+/*
+ * Guillera：
+ *   G = 1/2 Σ (-8)^k (3k+2) / ((2k+1)^3 C(2k,k)^3)
+ * 相邻两项之比 p(k)/q(k) = -k^3 / (2k+1)^3，a(k) = 3k+2
+ */
+void catalan_leaf(const bs_series_t *s, bs_node_t *node, uint64_t k, int track) {
+    (void)s;
+    mpz_ui_pow_ui(node->p, k, 3);
+    mpz_neg(node->p, node->p);
+    mpz_ui_pow_ui(node->q, 2 * k + 1, 3);
+    mpz_mul_ui(node->t, node->p, 3 * k + 2);
+    
+    if (track) {
+        fac_mul_ui(&node->fp, k, 3);
+        fac_mul_ui(&node->fq, 2 * k + 1, 3);
+    }
+}
+
+double catalan_bits(const bs_series_t *s, uint64_t a, uint64_t b) {
+    (void)s;
+    return 3.0 * sum_log2_linear(a, b, 2, 1);
+}
+
+double catalan_term_bits(const bs_series_t *s, double k) {
+    (void)s;
+    return 3.0 * log2(2 * k + 1);
+}
+
+/* C(2k,k) >= 4^k/(2k+1)，第k项不超过 (3k+2) 8^(-k)，交错递减 */
+double catalan_tail(const bs_series_t *s, uint64_t n) {
+    (void)s;
+    return log2(3.0 * n + 2) - 3.0 * n;
+}
+
+const bs_series_t catalan_series = { catalan_leaf, catalan_bits, catalan_term_bits, catalan_tail, 1, 2, 0 };
+
+void compute_catalan(mpf_t x, uint64_t digits) {
+    (void)digits;
+    uint64_t terms = bs_terms(&catalan_series, 1.0 - (double)mpf_get_prec(x));  // 每项约 1/8
+    
+    bs_node_t root;
+    bs_node_init(&root);
+    bs_evaluate(&catalan_series, &root, 1, terms);
+    
+    /* G = (2 + T/Q) / 2 */
+    double r = mpf_set_ratio(x, root.t, root.q);
+    mpf_add_ui(x, x, 2);
+    r = log2_sum(ball_round(r, x), catalan_series.tail(&catalan_series, terms));
+    mpf_div_2exp(x, x, 1);
+    radius_log2 = ball_round(r - 1, x);
+    
+    bs_node_clear(&root);
+}
+
+/*
+ * 将计算结果保存到文本文件，文件名为“常数名_位数位.text”
+ * 参数说明：
+ *   digits_str - 计算得到的常数小数部分字符串
+ *   digits     - 小数位数
+ */
+void save_result_to_file(const char *digits_str, uint64_t digits) {
+    /* 参数检查 */
+    if (!digits_str || digits <= 0) return;
+    const constant_t *c = &constants[constant_id];
+    
+    /* 构造文件名 */
+    char filename[256];
+    if (digits == 0) {  // 持续计算模式
+        snprintf(filename, sizeof(filename), "%s_永远.text", c->name);
+    } else {
+        snprintf(filename, sizeof(filename), "%s_%llu位.text", c->name, (unsigned long long)digits);
+    }
+    if (output_base != 10) {  // 非十进制在文件名中注明进制
+        size_t len = strlen(filename) - strlen(".text");
+        snprintf(filename + len, sizeof(filename) - len, "_%d进制.text", output_base);
     }
     
     /* 打开文件用于写入 */
@@ -409,20 +5916,30 @@ void save_pi_to_file(const char *pi_str, uint64_t digits) {
     }
     
     /* 写入文件内容 */
-    fprintf(fp, "3.");  // 写入整数部分和小数点
+    /* 写入整数部分（换算到输出进制）和小数点 */
+    char int_digits[72];
+    unsigned long int_value = strtoul(c->int_part, NULL, 10);
+    int n = 0;
+    do {
+        int_digits[n++] = digit_chars[int_value % output_base];
+        int_value /= output_base;
+    } while (int_value > 0);
+    while (n > 0) fputc(int_digits[--n], fp);
+    fputc('.', fp);
     
     /* 逐字符写入小数部分 */
     for (uint64_t i = 0; i < digits; i++) {
-        fprintf(fp, "%c", pi_str[i]);
+        fprintf(fp, "%c", digits_str[i]);
     }
     
     /* 写入文件尾部信息 */
     fprintf(fp, "\n\n");
     fprintf(fp, "由SuperPi计算\n");
     fprintf(fp, "位数: %llu\n", (unsigned long long)digits);
-    fprintf(fp, "算法: Gauss-Legendre\n");
+    if (output_base != 10) fprintf(fp, "进制: %d\n", output_base);
+    fprintf(fp, "算法: %s\n", algorithm_name());
     fprintf(fp, "日期: %s\n", __DATE__);
     
     fclose(fp);  // 关闭文件
-    printf("结果已保存到: %s\n", filename);
+    if (!quiet) printf("结果已保存到: %s\n", filename);
 }
\ No newline at end of file